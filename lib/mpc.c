@@ -313,6 +313,7 @@ typedef struct {
   mpc_state_t state;
   
   char *string;
+  int length;
   char *buffer;
   FILE *file;
   
@@ -320,6 +321,8 @@ typedef struct {
   int marks_num;
   mpc_state_t* marks;
   
+  int spans;
+  
 } mpc_input_t;
 
 static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
@@ -332,7 +335,8 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
+  i->length = strlen(string);
+  i->string = malloc(i->length + 1);
   strcpy(i->string, string);
   i->buffer = NULL;
   i->file = NULL;
@@ -341,6 +345,8 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->marks_num = 0;
   i->marks = NULL;
   
+  i->spans = 0;
+  
   return i;
 }
 
@@ -355,6 +361,7 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = pipe;
   
@@ -362,6 +369,8 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->marks_num = 0;
   i->marks = NULL;
   
+  i->spans = 0;
+  
   return i;
   
 }
@@ -376,6 +385,7 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = file;
   
@@ -383,6 +393,8 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->marks_num = 0;
   i->marks = NULL;
   
+  i->spans = 0;
+  
   return i;
 }
 
@@ -441,6 +453,15 @@ static void mpc_input_rewind(mpc_input_t *i) {
   mpc_input_unmark(i);
 }
 
+static void mpc_input_seek(mpc_input_t *i, mpc_state_t s) {
+  
+  i->state = s;
+  
+  if (i->type == MPC_INPUT_FILE) {
+    fseek(i->file, i->state.pos, SEEK_SET);
+  }
+}
+
 static int mpc_input_buffer_in_range(mpc_input_t *i) {
   return i->state.pos < (strlen(i->buffer) + i->marks[0].pos);
 }
@@ -450,7 +471,7 @@ static char mpc_input_buffer_get(mpc_input_t *i) {
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos == i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
   if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
   return 0;
@@ -520,7 +541,9 @@ static int mpc_input_success(mpc_input_t *i, char c, char **o) {
     i->state.row++;
   }
   
-  if (o) {
+  if (o && i->spans) {
+    (*o) = NULL;
+  } else if (o) {
     (*o) = malloc(2);
     (*o)[0] = c;
     (*o)[1] = '\0';
@@ -577,14 +600,11 @@ static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
 
 static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   
-  char *co = NULL;
   const char *x = c;
 
   mpc_input_mark(i);
   while (*x) {
-    if (mpc_input_char(i, *x, &co)) {
-      free(co);
-    } else {
+    if (!mpc_input_char(i, *x, NULL)) {
       mpc_input_rewind(i);
       return 0;
     }
@@ -592,11 +612,69 @@ static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   }
   mpc_input_unmark(i);
   
-  *o = malloc(strlen(c) + 1);
-  strcpy(*o, c);
+  if (i->spans) {
+    *o = NULL;
+  } else {
+    *o = malloc(strlen(c) + 1);
+    strcpy(*o, c);
+  }
   return 1;
 }
 
+/*
+** Inside a span no results are built, so primitives
+** give NULL, and once the outermost span ends the text
+** it matched is copied out of the input in one go. A
+** pipe can't seek back to it, so is marked, even when
+** predictive, to keep the span in the buffer.
+*/
+
+static void mpc_input_span_begin(mpc_input_t *i) {
+  
+  i->spans++;
+  
+  if (i->type == MPC_INPUT_PIPE) {
+    i->marks_num++;
+    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_num);
+    i->marks[i->marks_num-1] = i->state;
+    if (i->marks_num == 1) { i->buffer = calloc(1, 1); }
+  }
+  
+}
+
+static void mpc_input_span_end(mpc_input_t *i, int pos, char **o) {
+  
+  int n = i->state.pos - pos;
+  
+  i->spans--;
+  
+  if (o && i->spans) {
+    *o = NULL;
+  } else if (o) {
+    *o = malloc(n + 1);
+    switch (i->type) {
+      case MPC_INPUT_STRING: memcpy(*o, i->string + pos, n); break;
+      case MPC_INPUT_FILE:
+        fseek(i->file, pos, SEEK_SET);
+        n = fread(*o, 1, n, i->file);
+        fseek(i->file, i->state.pos, SEEK_SET);
+      break;
+      case MPC_INPUT_PIPE: memcpy(*o, i->buffer + (pos - i->marks[0].pos), n); break;
+    }
+    (*o)[n] = '\0';
+  }
+  
+  if (i->type == MPC_INPUT_PIPE) {
+    i->marks_num--;
+    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_num);
+    if (i->marks_num == 0) {
+      free(i->buffer);
+      i->buffer = NULL;
+    }
+  }
+  
+}
+
 /*
 ** Parser Type
 */
@@ -629,9 +707,46 @@ enum {
   MPC_TYPE_COUNT     = 22,
   
   MPC_TYPE_OR        = 23,
-  MPC_TYPE_AND       = 24
+  MPC_TYPE_AND       = 24,
+  
+  MPC_TYPE_PACKRAT   = 25,
+  
+  MPC_TYPE_DFA       = 26,
+  
+  MPC_TYPE_SPAN      = 27
+};
+
+/*
+** A regex compiled by `mpc_re_dfa`. States are rows
+** of `next`, one column per character plus one for
+** the end of input, giving the state to move to or
+** whether to stop. Where `errs` isn't zero it names
+** the set of errors left by the combinators there.
+** When the first character rejects the regex `fails`
+** names the error it returns.
+*/
+
+enum {
+  MPC_DFA_ACCEPT = -1,
+  MPC_DFA_FAIL   = -2,
+  MPC_DFA_REJECT = -3,
+  MPC_DFA_WIDTH  = 257
 };
 
+typedef struct {
+  int expected_num;
+  char **expected;
+} mpc_dfa_err_t;
+
+typedef struct {
+  int states_num;
+  int *next;
+  int *errs;
+  int fails[MPC_DFA_WIDTH];
+  int err_sets_num;
+  mpc_dfa_err_t *err_sets;
+} mpc_dfa_t;
+
 typedef struct { char *m; } mpc_pdata_fail_t;
 typedef struct { mpc_ctor_t lf; void *x; } mpc_pdata_lift_t;
 typedef struct { mpc_parser_t *x; char *m; } mpc_pdata_expect_t;
@@ -646,6 +761,9 @@ typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
 typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { mpc_parser_t *x; mpc_parser_t *key; } mpc_pdata_packrat_t;
+typedef struct { mpc_parser_t *x; mpc_dfa_t *d; } mpc_pdata_dfa_t;
+typedef struct { mpc_parser_t *x; int text; } mpc_pdata_span_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -662,11 +780,15 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_packrat_t packrat;
+  mpc_pdata_dfa_t dfa;
+  mpc_pdata_span_t span;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
   char retained;
   char *name;
+  int id;
   char type;
   mpc_pdata_t data;
 };
@@ -711,6 +833,7 @@ static mpc_stack_t *mpc_stack_new(const char *filename) {
 
 static void mpc_stack_err(mpc_stack_t *s, mpc_err_t* e) {
   mpc_err_t *errs[2];
+  if (s->err == NULL) { s->err = e; return; }
   errs[0] = s->err;
   errs[1] = e;
   s->err = mpc_err_or(errs, 2);
@@ -845,7 +968,7 @@ static void mpc_stack_popr_out(mpc_stack_t *s, int n, mpc_dtor_t *ds) {
   mpc_result_t x;
   while (n) {
     mpc_stack_popr(s, &x);
-    ds[n-1](x.output);
+    if (ds) { ds[n-1](x.output); }
     n--;
   }
 }
@@ -854,7 +977,7 @@ static void mpc_stack_popr_out_single(mpc_stack_t *s, int n, mpc_dtor_t dx) {
   mpc_result_t x;
   while (n) {
     mpc_stack_popr(s, &x);
-    dx(x.output);
+    if (dx) { dx(x.output); }
     n--;
   }
 }
@@ -868,7 +991,7 @@ static void mpc_stack_popr_n(mpc_stack_t *s, int n) {
 }
 
 static mpc_val_t *mpc_stack_merger_out(mpc_stack_t *s, int n, mpc_fold_t f) {
-  mpc_val_t *x = f(n, (mpc_val_t**)(&s->results[s->results_num-n]));
+  mpc_val_t *x = f ? f(n, (mpc_val_t**)(&s->results[s->results_num-n])) : NULL;
   mpc_stack_popr_n(s, n);
   return x;
 }
@@ -879,6 +1002,360 @@ static mpc_err_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
   return x;
 }
 
+/*
+** Packrat Cache
+**
+** Maps a packrat parser's key and an input position
+** to the result of parsing there, and where parsing
+** finished if it succeeded. Results are ASTs, copied
+** in and out, so only the results of `mpca` parsers
+** can be cached. Positions parsing started from are
+** kept on a stack until the parser returns.
+**
+** Errors stacked while parsing, such as those of an
+** optional parser that didn't match, are kept with
+** the result and stacked again when it is replayed,
+** so error messages are the same as without caching.
+*/
+
+static long mpc_packrat_max = 64 * 1024 * 1024;
+
+void mpc_packrat_limit(long bytes) {
+  mpc_packrat_max = bytes;
+}
+
+typedef struct {
+  mpc_parser_t *key;
+  int pos;
+  int success;
+  mpc_state_t end;
+  mpc_result_t result;
+  mpc_err_t *errs;
+} mpc_packrat_entry_t;
+
+typedef struct {
+  mpc_state_t state;
+  mpc_err_t *errs;
+} mpc_packrat_start_t;
+
+typedef struct {
+  int slots;
+  mpc_packrat_entry_t *entries;
+  
+  int starts_num;
+  int starts_slots;
+  mpc_packrat_start_t *starts;
+  
+  mpc_packrat_stats_t stats;
+} mpc_packrat_t;
+
+static mpc_ast_t *mpc_ast_copy(mpc_ast_t *a) {
+  
+  int i;
+  mpc_ast_t *r;
+  
+  if (a == NULL) { return NULL; }
+  
+  r = mpc_ast_new(a->tag, a->contents);
+  r->rule = a->rule;
+  
+  if (a->children_num > 0) {
+    r->children_num = a->children_num;
+    r->children = malloc(sizeof(mpc_ast_t*) * a->children_num);
+    for (i = 0; i < a->children_num; i++) {
+      r->children[i] = mpc_ast_copy(a->children[i]);
+    }
+  }
+  
+  return r;
+}
+
+static long mpc_ast_bytes(mpc_ast_t *a) {
+  
+  int i;
+  long n;
+  
+  if (a == NULL) { return 0; }
+  
+  n = sizeof(mpc_ast_t) + strlen(a->tag) + strlen(a->contents) + 2;
+  n += sizeof(mpc_ast_t*) * a->children_num;
+  for (i = 0; i < a->children_num; i++) {
+    n += mpc_ast_bytes(a->children[i]);
+  }
+  
+  return n;
+}
+
+static mpc_err_t *mpc_err_copy(mpc_err_t *e) {
+  
+  int i;
+  mpc_err_t *x = malloc(sizeof(mpc_err_t));
+  
+  x->state = e->state;
+  x->filename = malloc(strlen(e->filename) + 1);
+  strcpy(x->filename, e->filename);
+  
+  x->failure = NULL;
+  if (e->failure) {
+    x->failure = malloc(strlen(e->failure) + 1);
+    strcpy(x->failure, e->failure);
+  }
+  
+  x->expected_num = e->expected_num;
+  x->expected = NULL;
+  if (e->expected_num > 0) {
+    x->expected = malloc(sizeof(char*) * e->expected_num);
+    for (i = 0; i < e->expected_num; i++) {
+      x->expected[i] = malloc(strlen(e->expected[i]) + 1);
+      strcpy(x->expected[i], e->expected[i]);
+    }
+  }
+  
+  return x;
+}
+
+static long mpc_err_bytes(mpc_err_t *e) {
+  
+  int i;
+  long n = sizeof(mpc_err_t) + strlen(e->filename) + 1;
+  
+  if (e->failure) { n += strlen(e->failure) + 1; }
+  n += sizeof(char*) * e->expected_num;
+  for (i = 0; i < e->expected_num; i++) {
+    n += strlen(e->expected[i]) + 1;
+  }
+  
+  return n;
+}
+
+/* The table is only allocated once the first result fits under the limit */
+static mpc_packrat_t *mpc_packrat_new(void) {
+  return calloc(1, sizeof(mpc_packrat_t));
+}
+
+static void mpc_packrat_delete(mpc_packrat_t *c) {
+  
+  int i;
+  
+  for (i = 0; i < c->slots; i++) {
+    if (c->entries[i].key == NULL) { continue; }
+    if (c->entries[i].success) {
+      mpc_ast_delete(c->entries[i].result.output);
+    } else {
+      mpc_err_delete(c->entries[i].result.error);
+    }
+    if (c->entries[i].errs) { mpc_err_delete(c->entries[i].errs); }
+  }
+  
+  free(c->entries);
+  free(c->starts);
+  free(c);
+}
+
+static mpc_packrat_entry_t *mpc_packrat_slot(mpc_packrat_entry_t *es, int slots, mpc_parser_t *key, int pos) {
+  
+  unsigned long j = (((unsigned long)key >> 4) * 31 + (unsigned long)pos * 2654435761UL) & (slots - 1);
+  
+  while (es[j].key && (es[j].key != key || es[j].pos != pos)) {
+    j = (j + 1) & (slots - 1);
+  }
+  
+  return &es[j];
+}
+
+static mpc_packrat_entry_t *mpc_packrat_find(mpc_packrat_t *c, mpc_parser_t *key, int pos) {
+  mpc_packrat_entry_t *e;
+  if (c->slots == 0) { return NULL; }
+  e = mpc_packrat_slot(c->entries, c->slots, key, pos);
+  return e->key ? e : NULL;
+}
+
+static void mpc_packrat_add(mpc_packrat_t *c, mpc_parser_t *key, int pos, int success, mpc_state_t end, mpc_result_t r, mpc_err_t *errs) {
+  
+  int i, slots;
+  long bytes, grow;
+  mpc_packrat_entry_t *es, *e;
+  
+  /* Keep the table at most half full, counting both tables while it grows */
+  slots = c->slots;
+  while ((c->stats.entries + 1) * 2 > slots) { slots = slots ? slots * 2 : 256; }
+  grow = slots != c->slots ? (long)sizeof(mpc_packrat_entry_t) * slots : 0;
+  
+  /* Results that with any growth would take the cache over the limit aren't cached */
+  bytes = success ? mpc_ast_bytes(r.output) : mpc_err_bytes(r.error);
+  if (errs) { bytes += mpc_err_bytes(errs); }
+  if (c->stats.bytes + grow + bytes > mpc_packrat_max) {
+    c->stats.uncached++;
+    return;
+  }
+  
+  if (grow) {
+    es = calloc(slots, sizeof(mpc_packrat_entry_t));
+    for (i = 0; i < c->slots; i++) {
+      if (c->entries[i].key == NULL) { continue; }
+      *mpc_packrat_slot(es, slots, c->entries[i].key, c->entries[i].pos) = c->entries[i];
+    }
+    free(c->entries);
+    c->stats.bytes += sizeof(mpc_packrat_entry_t) * (slots - c->slots);
+    c->entries = es;
+    c->slots = slots;
+  }
+  
+  e = mpc_packrat_slot(c->entries, c->slots, key, pos);
+  e->key = key;
+  e->pos = pos;
+  e->success = success;
+  e->end = end;
+  e->result = success
+    ? mpc_result_out(mpc_ast_copy(r.output))
+    : mpc_result_err(mpc_err_copy(r.error));
+  e->errs = errs ? mpc_err_copy(errs) : NULL;
+  
+  c->stats.entries++;
+  c->stats.bytes += bytes;
+}
+
+static void mpc_packrat_push(mpc_packrat_t *c, mpc_state_t s, mpc_err_t *errs) {
+  if (c->starts_num == c->starts_slots) {
+    c->starts_slots = c->starts_slots ? c->starts_slots * 2 : 16;
+    c->starts = realloc(c->starts, sizeof(mpc_packrat_start_t) * c->starts_slots);
+  }
+  c->starts[c->starts_num].state = s;
+  c->starts[c->starts_num].errs = errs;
+  c->starts_num++;
+}
+
+static mpc_packrat_start_t mpc_packrat_pop(mpc_packrat_t *c) {
+  return c->starts[--c->starts_num];
+}
+
+/*
+** A regex compiled to a DFA is matched here in one
+** go. Apart from those on the first character, which
+** the table knows the error for, failures are left
+** to its combinators, which parse it again to get
+** both any backtracking and the error message right.
+**
+** Only the errors of the last character to leave
+** any are kept, as earlier ones are always further
+** back and so would be dropped by `mpc_stack_err`.
+*/
+
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+  
+  int i, j;
+  
+  for (i = 0; i < d->err_sets_num; i++) {
+    for (j = 0; j < d->err_sets[i].expected_num; j++) {
+      free(d->err_sets[i].expected[j]);
+    }
+    free(d->err_sets[i].expected);
+  }
+  
+  free(d->err_sets);
+  free(d->next);
+  free(d->errs);
+  free(d);
+}
+
+static mpc_err_t *mpc_dfa_err(const char *filename, mpc_state_t s, mpc_dfa_err_t *e) {
+  
+  int i;
+  mpc_err_t *x = mpc_err_new(filename, s, e->expected[0]);
+  
+  for (i = 1; i < e->expected_num; i++) {
+    mpc_err_add_expected(x, e->expected[i]);
+  }
+  
+  return x;
+}
+
+static int mpc_dfa_run(mpc_input_t *i, mpc_stack_t *stk, mpc_dfa_t *d, mpc_result_t *r) {
+  
+  int c, t, e = 0, x = 0;
+  int n = 0, slots = 0;
+  char *buf = NULL;
+  mpc_state_t s = i->state;
+  mpc_state_t es = s;
+  
+  while (1) {
+    
+    if (i->type == MPC_INPUT_STRING) {
+      c = (unsigned char)i->string[s.pos];
+      c = c ? c : MPC_DFA_WIDTH-1;
+    } else {
+      c = fgetc(i->file);
+      c = c != EOF ? c : MPC_DFA_WIDTH-1;
+    }
+    
+    t = x * MPC_DFA_WIDTH + c;
+    
+    if (d->errs[t]) {
+      e = d->errs[t];
+      es = s;
+      es.next = c == MPC_DFA_WIDTH-1 ? '\0' : c;
+    }
+    
+    x = d->next[t];
+    if (x < 0) { break; }
+    
+    if (i->type == MPC_INPUT_FILE && !i->spans) {
+      if (n + 1 >= slots) {
+        slots = slots ? slots * 2 : 32;
+        buf = realloc(buf, slots);
+      }
+      buf[n++] = c;
+    }
+    
+    s.pos++;
+    s.col++;
+    if (c == '\n') {
+      s.col = 0;
+      s.row++;
+    }
+  }
+  
+  /* Without backtracking the combinators don't rewind, so leave it to them */
+  if (x == MPC_DFA_REJECT && i->backtrack < 1) { x = MPC_DFA_FAIL; }
+  
+  if (x != MPC_DFA_ACCEPT) {
+    
+    if (i->type == MPC_INPUT_FILE) { fseek(i->file, i->state.pos, SEEK_SET); }
+    free(buf);
+    
+    if (x == MPC_DFA_FAIL) { return -1; }
+    
+    s.next = c == MPC_DFA_WIDTH-1 ? '\0' : c;
+    if (e) { mpc_stack_err(stk, mpc_dfa_err(i->filename, s, &d->err_sets[e-1])); }
+    r->error = mpc_dfa_err(i->filename, s, &d->err_sets[d->fails[c]-1]);
+    return 0;
+  }
+  
+  if (e) {
+    mpc_stack_err(stk, mpc_dfa_err(i->filename, es, &d->err_sets[e-1]));
+    s.next = es.next;
+  }
+  
+  if (i->type == MPC_INPUT_FILE) {
+    fseek(i->file, s.pos, SEEK_SET);
+  }
+  
+  if (i->spans) {
+    r->output = NULL;
+  } else {
+    if (i->type == MPC_INPUT_FILE) {
+      r->output = buf ? buf : malloc(1);
+    } else {
+      r->output = malloc(s.pos - i->state.pos + 1);
+      memcpy(r->output, i->string + i->state.pos, s.pos - i->state.pos);
+    }
+    ((char*)r->output)[s.pos - i->state.pos] = '\0';
+  }
+  
+  i->state = s;
+  return 1;
+}
+
 /*
 ** This is rather pleasant. The core parsing routine
 ** is written in about 200 lines of C.
@@ -905,7 +1382,11 @@ static mpc_err_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
 #define MPC_FAILURE(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_err(x), 0); continue
 #define MPC_PRIMATIVE(x, f) if (f) { MPC_SUCCESS(x); } else { MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Incorrect Input")); }
 
-int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
+/* Inside a span nothing is built, so no callbacks are made */
+
+#define MPC_BUILD(x) (i->spans ? NULL : (x))
+
+int mpc_parse_input_stats(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final, mpc_packrat_stats_t *stats) {
   
   /* Stack */
   int st = 0;
@@ -913,8 +1394,15 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
   mpc_stack_t *stk = mpc_stack_new(i->filename);
   
   /* Variables */
+  int k;
   char *s;
   mpc_result_t r;
+  
+  /* Packrat Cache, made when first needed */
+  mpc_packrat_t *pc = NULL;
+  mpc_packrat_entry_t *pe;
+  mpc_packrat_start_t ps;
+  mpc_err_t *errs;
 
   /* Go! */
   mpc_stack_pushp(stk, init);
@@ -930,7 +1418,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
       case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Parser Undefined!"));      
       case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
       case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i->filename, i->state, p->data.fail.m));
-      case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
+      case MPC_TYPE_LIFT:      MPC_SUCCESS(MPC_BUILD(p->data.lift.lf()));
       case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
     
       /* Basic Parsers */
@@ -962,7 +1450,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         if (st == 0) { MPC_CONTINUE(1, p->data.apply.x); }
         if (st == 1) {
           if (mpc_stack_popr(stk, &r)) {
-            MPC_SUCCESS(p->data.apply.f(r.output));
+            MPC_SUCCESS(MPC_BUILD(p->data.apply.f(r.output)));
           } else {
             MPC_FAILURE(r.error);
           }
@@ -972,7 +1460,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         if (st == 0) { MPC_CONTINUE(1, p->data.apply_to.x); }
         if (st == 1) {
           if (mpc_stack_popr(stk, &r)) {
-            MPC_SUCCESS(p->data.apply_to.f(r.output, p->data.apply_to.d));
+            MPC_SUCCESS(MPC_BUILD(p->data.apply_to.f(r.output, p->data.apply_to.d)));
           } else {
             MPC_FAILURE(r.error);
           }
@@ -995,12 +1483,12 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         if (st == 1) {
           if (mpc_stack_popr(stk, &r)) {
             mpc_input_rewind(i);
-            p->data.not.dx(r.output);
+            if (!i->spans) { p->data.not.dx(r.output); }
             MPC_FAILURE(mpc_err_new(i->filename, i->state, "opposite"));
           } else {
             mpc_input_unmark(i);
             mpc_stack_err(stk, r.error);
-            MPC_SUCCESS(p->data.not.lf());
+            MPC_SUCCESS(MPC_BUILD(p->data.not.lf()));
           }
         }
       
@@ -1011,7 +1499,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
             MPC_SUCCESS(r.output);
           } else {
             mpc_stack_err(stk, r.error);
-            MPC_SUCCESS(p->data.not.lf());
+            MPC_SUCCESS(MPC_BUILD(p->data.not.lf()));
           }
         }
       
@@ -1025,7 +1513,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           } else {
             mpc_stack_popr(stk, &r);
             mpc_stack_err(stk, r.error);
-            MPC_SUCCESS(mpc_stack_merger_out(stk, st-1, p->data.repeat.f));
+            MPC_SUCCESS(mpc_stack_merger_out(stk, st-1, MPC_BUILD(p->data.repeat.f)));
           }
         }
       
@@ -1041,7 +1529,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
             } else {
               mpc_stack_popr(stk, &r);
               mpc_stack_err(stk, r.error);
-              MPC_SUCCESS(mpc_stack_merger_out(stk, st-1, p->data.repeat.f));
+              MPC_SUCCESS(mpc_stack_merger_out(stk, st-1, MPC_BUILD(p->data.repeat.f)));
             }
           }
         }
@@ -1054,14 +1542,14 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           } else {
             if (st != (p->data.repeat.n+1)) {
               mpc_stack_popr(stk, &r);
-              mpc_stack_popr_out_single(stk, st-1, p->data.repeat.dx);
+              mpc_stack_popr_out_single(stk, st-1, MPC_BUILD(p->data.repeat.dx));
               mpc_input_rewind(i);
               MPC_FAILURE(mpc_err_count(r.error, p->data.repeat.n));
             } else {
               mpc_stack_popr(stk, &r);
               mpc_stack_err(stk, r.error);
               mpc_input_unmark(i);
-              MPC_SUCCESS(mpc_stack_merger_out(stk, st-1, p->data.repeat.f));
+              MPC_SUCCESS(mpc_stack_merger_out(stk, st-1, MPC_BUILD(p->data.repeat.f)));
             }
           }
         }
@@ -1085,18 +1573,84 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
       
       case MPC_TYPE_AND:
         
-        if (p->data.or.n == 0) { MPC_SUCCESS(p->data.and.f(0, NULL)); }
+        if (p->data.or.n == 0) { MPC_SUCCESS(MPC_BUILD(p->data.and.f(0, NULL))); }
         
         if (st == 0) { mpc_input_mark(i); MPC_CONTINUE(st+1, p->data.and.xs[st]); }
         if (st <= p->data.and.n) {
           if (!mpc_stack_peekr(stk, &r)) {
             mpc_input_rewind(i);
             mpc_stack_popr(stk, &r);
-            mpc_stack_popr_out(stk, st-1, p->data.and.dxs);
+            mpc_stack_popr_out(stk, st-1, MPC_BUILD(p->data.and.dxs));
             MPC_FAILURE(r.error);
           }
           if (st <  p->data.and.n) { MPC_CONTINUE(st+1, p->data.and.xs[st]); }
-          if (st == p->data.and.n) { mpc_input_unmark(i); MPC_SUCCESS(mpc_stack_merger_out(stk, p->data.and.n, p->data.and.f)); }
+          if (st == p->data.and.n) { mpc_input_unmark(i); MPC_SUCCESS(mpc_stack_merger_out(stk, p->data.and.n, MPC_BUILD(p->data.and.f))); }
+        }
+      
+      /* Packrat Parsers */
+      
+      /* Pipes can't seek, predictive parsers don't rewind, and spans build nothing to cache */
+      
+      case MPC_TYPE_PACKRAT:
+        
+        if (st == 0) {
+          if (i->type == MPC_INPUT_PIPE || i->backtrack < 1 || i->spans) { MPC_CONTINUE(2, p->data.packrat.x); }
+          if (pc == NULL) { pc = mpc_packrat_new(); }
+          
+          pe = mpc_packrat_find(pc, p->data.packrat.key, i->state.pos);
+          if (pe) {
+            pc->stats.hits++;
+            if (pe->errs) { mpc_stack_err(stk, mpc_err_copy(pe->errs)); }
+            if (pe->success) {
+              mpc_input_seek(i, pe->end);
+              MPC_SUCCESS(mpc_ast_copy(pe->result.output));
+            } else {
+              MPC_FAILURE(mpc_err_copy(pe->result.error));
+            }
+          }
+          
+          /* Errors stacked from here on are collected apart from earlier ones */
+          pc->stats.misses++;
+          mpc_packrat_push(pc, i->state, stk->err);
+          stk->err = NULL;
+          MPC_CONTINUE(1, p->data.packrat.x);
+        }
+        if (st == 1) {
+          ps = mpc_packrat_pop(pc);
+          mpc_packrat_add(pc, p->data.packrat.key, ps.state.pos, mpc_stack_peekr(stk, &r), i->state, r, stk->err);
+          errs = stk->err;
+          stk->err = ps.errs;
+          if (errs) { mpc_stack_err(stk, errs); }
+        }
+        mpc_stack_popp(stk, &p, &st);
+        continue;
+      
+      /* Regex Parsers */
+      
+      /* Pipes can't seek back once the table has read past a match */
+      
+      case MPC_TYPE_DFA:
+        if (st == 0) {
+          k = i->type != MPC_INPUT_PIPE ? mpc_dfa_run(i, stk, p->data.dfa.d, &r) : -1;
+          if (k == 1) { MPC_SUCCESS(r.output); }
+          if (k == 0) { MPC_FAILURE(r.error); }
+          MPC_CONTINUE(1, p->data.dfa.x);
+        }
+        mpc_stack_popp(stk, &p, &st);
+        continue;
+      
+      /* Span Parsers */
+      
+      /* The state, less one, is the position the span started at */
+      
+      case MPC_TYPE_SPAN:
+        if (st == 0) { mpc_input_span_begin(i); MPC_CONTINUE(i->state.pos+1, p->data.span.x); }
+        if (mpc_stack_popr(stk, &r)) {
+          mpc_input_span_end(i, st-1, p->data.span.text ? &s : NULL);
+          MPC_SUCCESS(p->data.span.text ? s : NULL);
+        } else {
+          mpc_input_span_end(i, st-1, NULL);
+          MPC_FAILURE(r.error);
         }
       
       /* End */
@@ -1107,6 +1661,11 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
     }
   }
   
+  if (stats) {
+    if (pc) { *stats = pc->stats; } else { memset(stats, 0, sizeof(mpc_packrat_stats_t)); }
+  }
+  if (pc) { mpc_packrat_delete(pc); }
+  
   return mpc_stack_terminate(stk, final);
   
 }
@@ -1115,6 +1674,11 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
 #undef MPC_SUCCESS
 #undef MPC_FAILURE
 #undef MPC_PRIMATIVE
+#undef MPC_BUILD
+
+int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
+  return mpc_parse_input_stats(i, init, final, NULL);
+}
 
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
   int x;
@@ -1124,34 +1688,55 @@ int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_res
   return x;
 }
 
+int mpc_parse_stats(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, mpc_packrat_stats_t *s) {
+  int x;
+  mpc_input_t *i = mpc_input_new_string(filename, string);
+  x = mpc_parse_input_stats(i, p, r, s);
+  mpc_input_delete(i);
+  return x;
+}
+
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_parse_file_stats(filename, file, p, r, NULL);
+}
+
+int mpc_parse_file_stats(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r, mpc_packrat_stats_t *s) {
   int x;
   mpc_input_t *i = mpc_input_new_file(filename, file);
-  x = mpc_parse_input(i, p, r);
+  x = mpc_parse_input_stats(i, p, r, s);
   mpc_input_delete(i);
   return x;
 }
 
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_parse_pipe_stats(filename, pipe, p, r, NULL);
+}
+
+int mpc_parse_pipe_stats(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r, mpc_packrat_stats_t *s) {
   int x;
   mpc_input_t *i = mpc_input_new_pipe(filename, pipe);
-  x = mpc_parse_input(i, p, r);
+  x = mpc_parse_input_stats(i, p, r, s);
   mpc_input_delete(i);
   return x;
 }
 
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_parse_contents_stats(filename, p, r, NULL);
+}
+
+int mpc_parse_contents_stats(const char *filename, mpc_parser_t *p, mpc_result_t *r, mpc_packrat_stats_t *s) {
   
   FILE *f = fopen(filename, "rb");
   int res;
   
   if (f == NULL) {
+    if (s) { memset(s, 0, sizeof(mpc_packrat_stats_t)); }
     r->output = NULL;
     r->error = mpc_err_fail(filename, mpc_state_new(), "Unable to open file!");
     return 0;
   }
   
-  res = mpc_parse_file(filename, f, p, r);
+  res = mpc_parse_file_stats(filename, f, p, r, s);
   fclose(f);
   return res;
 }
@@ -1200,6 +1785,13 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
     case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
     case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
+    case MPC_TYPE_PACKRAT:  mpc_undefine_unretained(p->data.packrat.x, 0);  break;
+    case MPC_TYPE_SPAN:     mpc_undefine_unretained(p->data.span.x, 0);     break;
+    
+    case MPC_TYPE_DFA:
+      mpc_undefine_unretained(p->data.dfa.x, 0);
+      mpc_dfa_delete(p->data.dfa.d);
+      break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1500,6 +2092,22 @@ mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
   return p;
 }
 
+mpc_parser_t *mpc_span(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_SPAN;
+  p->data.span.x = a;
+  p->data.span.text = 1;
+  return p;
+}
+
+mpc_parser_t *mpc_skip(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_SPAN;
+  p->data.span.x = a;
+  p->data.span.text = 0;
+  return p;
+}
+
 mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NOT;
@@ -1614,7 +2222,7 @@ mpc_parser_t *mpc_soi(void) {
 
 mpc_parser_t *mpc_whitespace(void) { return mpc_expect(mpc_oneof(" \f\n\r\t\v"), "whitespace"); }
 mpc_parser_t *mpc_whitespaces(void) { return mpc_expect(mpc_many(mpcf_strfold, mpc_whitespace()), "spaces"); }
-mpc_parser_t *mpc_blank(void) { return mpc_expect(mpc_apply(mpc_whitespaces(), mpcf_free), "whitespace"); }
+mpc_parser_t *mpc_blank(void) { return mpc_expect(mpc_skip(mpc_whitespaces()), "whitespace"); }
 
 mpc_parser_t *mpc_newline(void) { return mpc_expect(mpc_char('\n'), "newline"); }
 mpc_parser_t *mpc_tab(void) { return mpc_expect(mpc_char('\t'), "tab"); }
@@ -1923,6 +2531,438 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
+/*
+** Regexes which only match characters are also
+** compiled into a DFA, see `mpc_dfa_run`. It has
+** to match just as the combinators would, so each
+** repetition takes all it can and gives nothing
+** back, and alternatives are tried in order.
+**
+** A state is what is left to match, as a stack of
+** frames. Each frame either matches the parser `x`
+** or, if `loop` is set, tries another pass of the
+** repetition `x` which has passed `loop` times.
+**
+** The table commits to an alternative or pass once
+** it reads a character of it. Should that fail the
+** combinators would backtrack, so the table gives
+** up and leaves the match to them.
+**
+** Errors are only `stale` if they might have been
+** made after a rewind, which restores the character
+** an error says it found to an earlier one.
+*/
+
+#define MPC_DFA_STATES_MAX 256
+
+enum {
+  MPC_RE_FAIL    = 0,
+  MPC_RE_EMPTY   = 1,
+  MPC_RE_CONSUME = 2,
+  MPC_RE_BAIL    = 3
+};
+
+typedef struct {
+  mpc_parser_t *x;
+  int loop;
+} mpc_re_frame_t;
+
+typedef struct {
+  int n;
+  mpc_re_frame_t *fs;
+} mpc_re_state_t;
+
+typedef struct {
+  int n;
+  char **xs;
+} mpc_re_errs_t;
+
+typedef struct {
+  mpc_dfa_t *d;
+  int full;
+  
+  int states_slots;
+  mpc_re_state_t *states;
+  
+  int top;
+  int slots;
+  mpc_re_frame_t *stack;
+  
+  mpc_re_errs_t errs;
+  mpc_re_errs_t fail;
+  mpc_re_errs_t made;
+  int stale;
+} mpc_re_build_t;
+
+static int mpc_re_dfa_supported(mpc_parser_t *p) {
+  
+  int i;
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SATISFY:
+      return 1;
+    
+    case MPC_TYPE_LIFT:   return p->data.lift.lf == mpcf_ctor_str;
+    case MPC_TYPE_EXPECT: return mpc_re_dfa_supported(p->data.expect.x);
+    case MPC_TYPE_MAYBE:  return p->data.not.lf == mpcf_ctor_str && mpc_re_dfa_supported(p->data.not.x);
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      return p->data.repeat.f == mpcf_strfold && mpc_re_dfa_supported(p->data.repeat.x);
+    
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { return 0; }
+      for (i = 0; i < p->data.or.n; i++) {
+        if (!mpc_re_dfa_supported(p->data.or.xs[i])) { return 0; }
+      }
+      return 1;
+    
+    case MPC_TYPE_AND:
+      if (p->data.and.n == 0 || p->data.and.f != mpcf_strfold) { return 0; }
+      for (i = 0; i < p->data.and.n; i++) {
+        if (!mpc_re_dfa_supported(p->data.and.xs[i])) { return 0; }
+      }
+      return 1;
+    
+    default: return 0;
+  }
+}
+
+static int mpc_re_dfa_primitive(mpc_parser_t *p) {
+  return p->type >= MPC_TYPE_ANY && p->type <= MPC_TYPE_SATISFY;
+}
+
+static int mpc_re_dfa_match(mpc_parser_t *p, int c) {
+  
+  if (c == MPC_DFA_WIDTH-1) { return 0; }
+  
+  switch (p->type) {
+    case MPC_TYPE_ANY:     return 1;
+    case MPC_TYPE_SINGLE:  return (char)c == p->data.single.x;
+    case MPC_TYPE_RANGE:   return (char)c >= p->data.range.x && (char)c <= p->data.range.y;
+    case MPC_TYPE_ONEOF:   return strchr(p->data.string.x, (char)c) != 0;
+    case MPC_TYPE_NONEOF:  return strchr(p->data.string.x, (char)c) == 0;
+    case MPC_TYPE_SATISFY: return p->data.satisfy.f((char)c);
+    default: return 0;
+  }
+}
+
+static void mpc_re_errs_add(mpc_re_errs_t *e, char *x) {
+  
+  int i;
+  
+  for (i = 0; i < e->n; i++) {
+    if (strcmp(e->xs[i], x) == 0) { return; }
+  }
+  
+  e->n++;
+  e->xs = realloc(e->xs, sizeof(char*) * e->n);
+  e->xs[e->n-1] = x;
+}
+
+static void mpc_re_errs_merge(mpc_re_errs_t *e, mpc_re_errs_t *x) {
+  int i;
+  for (i = 0; i < x->n; i++) { mpc_re_errs_add(e, x->xs[i]); }
+}
+
+/* Mirrors `mpc_err_repeat` */
+static void mpc_re_errs_repeat(mpc_re_build_t *b, mpc_re_errs_t *e, mpc_re_errs_t *x, const char *prefix) {
+  
+  int i;
+  char *expect = malloc(strlen(prefix) + 1);
+  strcpy(expect, prefix);
+  
+  for (i = 0; i < x->n; i++) {
+    expect = realloc(expect, strlen(expect) + strlen(x->xs[i]) + strlen(" or ") + 1);
+    if (i > 0) { strcat(expect, i == x->n-1 ? " or " : ", "); }
+    strcat(expect, x->xs[i]);
+  }
+  
+  b->made.n++;
+  b->made.xs = realloc(b->made.xs, sizeof(char*) * b->made.n);
+  b->made.xs[b->made.n-1] = expect;
+  
+  mpc_re_errs_add(e, expect);
+}
+
+static void mpc_re_push(mpc_re_build_t *b, mpc_parser_t *x, int loop) {
+  if (b->top == b->slots) {
+    b->slots = b->slots ? b->slots * 2 : 16;
+    b->stack = realloc(b->stack, sizeof(mpc_re_frame_t) * b->slots);
+  }
+  b->stack[b->top].x = x;
+  b->stack[b->top].loop = loop;
+  b->top++;
+}
+
+/*
+** Runs `p` on the character `c`, with the frames
+** left to match pushed when it reads `c`. Errors
+** returned on failure go in `e`, while those which
+** the combinators keep on the stack go in `b->errs`.
+*/
+
+static int mpc_re_dfa_first(mpc_re_build_t *b, mpc_parser_t *p, int c, mpc_re_errs_t *e) {
+  
+  int i, j, k = MPC_RE_EMPTY, top = b->top;
+  char prefix[32];
+  mpc_re_errs_t x, *xs;
+  x.n = 0;
+  x.xs = NULL;
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_LIFT: return MPC_RE_EMPTY;
+    
+    case MPC_TYPE_EXPECT:
+      if (mpc_re_dfa_primitive(p->data.expect.x)) {
+        k = mpc_re_dfa_match(p->data.expect.x, c) ? MPC_RE_CONSUME : MPC_RE_FAIL;
+      } else {
+        k = mpc_re_dfa_first(b, p->data.expect.x, c, &x);
+        b->stale = b->stale || k == MPC_RE_FAIL;
+      }
+      if (k == MPC_RE_FAIL) { mpc_re_errs_add(e, p->data.expect.m); }
+      break;
+    
+    case MPC_TYPE_MAYBE:
+      k = mpc_re_dfa_first(b, p->data.not.x, c, &x);
+      if (k == MPC_RE_FAIL) {
+        mpc_re_errs_merge(&b->errs, &x);
+        k = MPC_RE_EMPTY;
+      }
+      break;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_re_push(b, p, 1);
+      k = mpc_re_dfa_first(b, p->data.repeat.x, c, &x);
+      if (k == MPC_RE_CONSUME) { break; }
+      b->top = top;
+      if (k == MPC_RE_EMPTY) { k = MPC_RE_BAIL; }
+      if (k != MPC_RE_FAIL) { break; }
+      
+      if (p->type == MPC_TYPE_MANY || (p->type == MPC_TYPE_COUNT && p->data.repeat.n == 0)) {
+        mpc_re_errs_merge(&b->errs, &x);
+        k = MPC_RE_EMPTY;
+      } else if (p->type == MPC_TYPE_MANY1) {
+        mpc_re_errs_repeat(b, e, &x, "one or more of ");
+      } else {
+        sprintf(prefix, "%i of ", p->data.repeat.n);
+        mpc_re_errs_repeat(b, e, &x, prefix);
+      }
+      break;
+    
+    /* On success the errors of earlier alternatives are kept, latest first */
+    
+    case MPC_TYPE_OR:
+      xs = calloc(p->data.or.n, sizeof(mpc_re_errs_t));
+      for (i = 0; i < p->data.or.n; i++) {
+        k = mpc_re_dfa_first(b, p->data.or.xs[i], c, &xs[i]);
+        if (k != MPC_RE_FAIL) { break; }
+      }
+      if (k == MPC_RE_FAIL) {
+        for (j = 0; j < p->data.or.n; j++) { mpc_re_errs_merge(e, &xs[j]); }
+      } else {
+        for (j = i-1; j >= 0; j--) { mpc_re_errs_merge(&b->errs, &xs[j]); }
+      }
+      for (j = 0; j < p->data.or.n; j++) { free(xs[j].xs); }
+      free(xs);
+      break;
+    
+    case MPC_TYPE_AND:
+      for (i = 0; i < p->data.and.n; i++) {
+        for (k = p->data.and.n-1; k > i; k--) {
+          mpc_re_push(b, p->data.and.xs[k], 0);
+        }
+        k = mpc_re_dfa_first(b, p->data.and.xs[i], c, e);
+        if (k == MPC_RE_CONSUME) { break; }
+        b->top = top;
+        if (k != MPC_RE_EMPTY) { break; }
+      }
+      break;
+    
+    default:
+      k = mpc_re_dfa_primitive(p) && mpc_re_dfa_match(p, c) ? MPC_RE_CONSUME : MPC_RE_BAIL;
+      break;
+  }
+  
+  free(x.xs);
+  return k;
+}
+
+static int mpc_re_dfa_state(mpc_re_build_t *b) {
+  
+  int i, j;
+  mpc_re_state_t *s;
+  mpc_dfa_t *d = b->d;
+  
+  for (i = 0; i < d->states_num; i++) {
+    s = &b->states[i];
+    if (s->n != b->top) { continue; }
+    for (j = 0; j < s->n; j++) {
+      if (s->fs[j].x != b->stack[j].x || s->fs[j].loop != b->stack[j].loop) { break; }
+    }
+    if (j == s->n) { return i; }
+  }
+  
+  if (d->states_num == MPC_DFA_STATES_MAX) {
+    b->full = 1;
+    return MPC_DFA_FAIL;
+  }
+  
+  if (d->states_num == b->states_slots) {
+    b->states_slots = b->states_slots ? b->states_slots * 2 : 8;
+    b->states = realloc(b->states, sizeof(mpc_re_state_t) * b->states_slots);
+    d->next = realloc(d->next, sizeof(int) * MPC_DFA_WIDTH * b->states_slots);
+    d->errs = realloc(d->errs, sizeof(int) * MPC_DFA_WIDTH * b->states_slots);
+  }
+  
+  s = &b->states[d->states_num];
+  s->n = b->top;
+  s->fs = malloc(sizeof(mpc_re_frame_t) * (b->top + 1));
+  memcpy(s->fs, b->stack, sizeof(mpc_re_frame_t) * b->top);
+  
+  return d->states_num++;
+}
+
+static int mpc_re_dfa_step(mpc_re_build_t *b, int state, int c) {
+  
+  int k, n, top;
+  mpc_re_frame_t f;
+  mpc_re_errs_t e;
+  
+  b->top = 0;
+  for (k = 0; k < b->states[state].n; k++) {
+    f = b->states[state].fs[k];
+    mpc_re_push(b, f.x, f.loop);
+  }
+  
+  free(b->errs.xs);
+  b->errs.n = 0;
+  b->errs.xs = NULL;
+  b->stale = 0;
+  
+  while (b->top > 0) {
+    
+    f = b->stack[--b->top];
+    e.n = 0;
+    e.xs = NULL;
+    
+    if (!f.loop) {
+      k = mpc_re_dfa_first(b, f.x, c, &e);
+    } else {
+      
+      /* Counts keep going past `n` passes, then fail */
+      n = f.x->type == MPC_TYPE_COUNT ? f.x->data.repeat.n : 0;
+      top = b->top;
+      mpc_re_push(b, f.x, f.loop > n ? f.loop : f.loop + 1);
+      
+      k = mpc_re_dfa_first(b, f.x->data.repeat.x, c, &e);
+      if (k != MPC_RE_CONSUME) { b->top = top; }
+      if (k == MPC_RE_EMPTY) { k = MPC_RE_BAIL; }
+      if (k == MPC_RE_FAIL && (f.x->type != MPC_TYPE_COUNT || f.loop == n)) {
+        mpc_re_errs_merge(&b->errs, &e);
+        k = MPC_RE_EMPTY;
+      }
+    }
+    
+    if (k == MPC_RE_FAIL && state == 0) {
+      free(b->fail.xs);
+      b->fail = e;
+      return b->stale ? MPC_DFA_FAIL : MPC_DFA_REJECT;
+    }
+    
+    free(e.xs);
+    if (k == MPC_RE_CONSUME) { return mpc_re_dfa_state(b); }
+    if (k != MPC_RE_EMPTY) { return MPC_DFA_FAIL; }
+  }
+  
+  return MPC_DFA_ACCEPT;
+}
+
+static int mpc_re_dfa_err_set(mpc_dfa_t *d, mpc_re_errs_t *e) {
+  
+  int i, j;
+  mpc_dfa_err_t *s;
+  
+  for (i = 0; i < d->err_sets_num; i++) {
+    s = &d->err_sets[i];
+    if (s->expected_num != e->n) { continue; }
+    for (j = 0; j < e->n; j++) {
+      if (strcmp(s->expected[j], e->xs[j]) != 0) { break; }
+    }
+    if (j == e->n) { return i+1; }
+  }
+  
+  d->err_sets_num++;
+  d->err_sets = realloc(d->err_sets, sizeof(mpc_dfa_err_t) * d->err_sets_num);
+  s = &d->err_sets[d->err_sets_num-1];
+  s->expected_num = e->n;
+  s->expected = malloc(sizeof(char*) * e->n);
+  for (j = 0; j < e->n; j++) {
+    s->expected[j] = malloc(strlen(e->xs[j]) + 1);
+    strcpy(s->expected[j], e->xs[j]);
+  }
+  
+  return d->err_sets_num;
+}
+
+static mpc_parser_t *mpc_re_dfa(mpc_parser_t *x) {
+  
+  int i, c, t;
+  mpc_re_build_t b;
+  mpc_dfa_t *d;
+  mpc_parser_t *p;
+  
+  if (!mpc_re_dfa_supported(x)) { return x; }
+  
+  memset(&b, 0, sizeof(mpc_re_build_t));
+  d = b.d = calloc(1, sizeof(mpc_dfa_t));
+  
+  mpc_re_push(&b, x, 0);
+  mpc_re_dfa_state(&b);
+  
+  for (i = 0; i < d->states_num && !b.full; i++) {
+    for (c = 0; c < MPC_DFA_WIDTH; c++) {
+      t = mpc_re_dfa_step(&b, i, c);
+      
+      /* Only an `and` rewinds back to the character before the regex */
+      if (t == MPC_DFA_REJECT && x->type != MPC_TYPE_AND) { t = MPC_DFA_FAIL; }
+      if (t == MPC_DFA_REJECT) { d->fails[c] = mpc_re_dfa_err_set(d, &b.fail); }
+      
+      d->next[i * MPC_DFA_WIDTH + c] = t;
+      d->errs[i * MPC_DFA_WIDTH + c] = t != MPC_DFA_FAIL && b.errs.n ? mpc_re_dfa_err_set(d, &b.errs) : 0;
+    }
+  }
+  
+  for (i = 0; i < d->states_num; i++) { free(b.states[i].fs); }
+  for (i = 0; i < b.made.n; i++) { free(b.made.xs[i]); }
+  free(b.states);
+  free(b.stack);
+  free(b.errs.xs);
+  free(b.fail.xs);
+  free(b.made.xs);
+  
+  if (b.full) {
+    mpc_dfa_delete(d);
+    return x;
+  }
+  
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.x = x;
+  p->data.dfa.d = d;
+  return p;
+}
+
 mpc_parser_t *mpc_re(const char *re) {
   
   char *err_msg;
@@ -1980,7 +3020,7 @@ mpc_parser_t *mpc_re(const char *re) {
   mpc_delete(RegexEnclose);
   mpc_cleanup(5, Regex, Term, Factor, Base, Range);
   
-  return r.output;
+  return mpc_re_dfa(r.output);
   
 }
 
@@ -2175,11 +3215,14 @@ mpc_val_t *mpcf_snd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 1)
 mpc_val_t *mpcf_trd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 2); }
 
 mpc_val_t *mpcf_strfold(int n, mpc_val_t **xs) {
-  char *x = calloc(1, 1);
-  int i;
-  for (i = 0; i < n; i++) {
-    x = realloc(x, strlen(x) + strlen(xs[i]) + 1);
-    strcat(x, xs[i]);
+  char *x;
+  int i, l = 0;
+  for (i = 0; i < n; i++) { l += strlen(xs[i]); }
+  x = malloc(l + 1);
+  x[0] = '\0';
+  for (i = 0, l = 0; i < n; i++) {
+    strcpy(x + l, xs[i]);
+    l += strlen(xs[i]);
     free(xs[i]);
   }
   return x;
@@ -2289,6 +3332,9 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)  { mpc_print_unretained(p->data.packrat.x, 0); }
+  if (p->type == MPC_TYPE_DFA)      { mpc_print_unretained(p->data.dfa.x, 0); }
+  if (p->type == MPC_TYPE_SPAN)     { mpc_print_unretained(p->data.span.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2419,6 +3465,7 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
   
   a->children_num = 0;
   a->children = NULL;
+  a->rule = 0;
   return a;
   
 }
@@ -2552,8 +3599,9 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
 }
 
 mpc_val_t *mpcf_str_ast(mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
-  free(c);
+  mpc_ast_t *a = mpc_ast_new("", "");
+  free(a->contents);
+  a->contents = c;
   return a;
 }
 
@@ -2569,6 +3617,10 @@ mpc_parser_t *mpca_root(mpc_parser_t *a) {
   return mpc_apply(a, (mpc_apply_t)mpc_ast_add_root);
 }
 
+mpc_parser_t *mpca_span(mpc_parser_t *a) {
+  return mpc_apply(mpc_span(a), mpcf_str_ast);
+}
+
 mpc_parser_t *mpca_not(mpc_parser_t *a) { return mpc_not(a, (mpc_dtor_t)mpc_ast_delete); }
 mpc_parser_t *mpca_maybe(mpc_parser_t *a) { return mpc_maybe(a); }
 mpc_parser_t *mpca_many(mpc_parser_t *a) { return mpc_many(mpcf_fold_ast, a); }
@@ -2621,6 +3673,16 @@ mpc_parser_t *mpca_and(int n, ...) {
   return p;  
 }
 
+static mpc_parser_t *mpca_packrat_key(mpc_parser_t *a, mpc_parser_t *key) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_PACKRAT;
+  p->data.packrat.x = a;
+  p->data.packrat.key = key;
+  return p;
+}
+
+mpc_parser_t *mpca_packrat(mpc_parser_t *a) { return mpca_packrat_key(a, a); }
+
 mpc_parser_t *mpca_total(mpc_parser_t *a) { return mpc_total(a, (mpc_dtor_t)mpc_ast_delete); }
 
 /*
@@ -2704,25 +3766,25 @@ static mpc_val_t *mpcaf_grammar_repeat(int n, mpc_val_t **xs) {
 static mpc_val_t *mpcaf_grammar_string(mpc_val_t *x, void *s) {
   mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape(x);
-  mpc_parser_t *p = (st->flags & MPC_LANG_WHITESPACE_SENSITIVE) ? mpc_string(y) : mpc_tok(mpc_string(y));
+  mpc_parser_t *p = (st->flags & MPC_LANG_WHITESPACE_SENSITIVE) ? mpca_span(mpc_string(y)) : mpc_tok(mpca_span(mpc_string(y)));
   free(y);
-  return mpca_tag(mpc_apply(p, mpcf_str_ast), "string");
+  return mpca_tag(p, "string");
 }
 
 static mpc_val_t *mpcaf_grammar_char(mpc_val_t *x, void *s) {
   mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape(x);
-  mpc_parser_t *p = (st->flags & MPC_LANG_WHITESPACE_SENSITIVE) ? mpc_char(y[0]) : mpc_tok(mpc_char(y[0]));
+  mpc_parser_t *p = (st->flags & MPC_LANG_WHITESPACE_SENSITIVE) ? mpca_span(mpc_char(y[0])) : mpc_tok(mpca_span(mpc_char(y[0])));
   free(y);
-  return mpca_tag(mpc_apply(p, mpcf_str_ast), "char");
+  return mpca_tag(p, "char");
 }
 
 static mpc_val_t *mpcaf_grammar_regex(mpc_val_t *x, void *s) {
   mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape_regex(x);
-  mpc_parser_t *p = (st->flags & MPC_LANG_WHITESPACE_SENSITIVE) ? mpc_re(y) : mpc_tok(mpc_re(y));
+  mpc_parser_t *p = (st->flags & MPC_LANG_WHITESPACE_SENSITIVE) ? mpca_span(mpc_re(y)) : mpc_tok(mpca_span(mpc_re(y)));
   free(y);
-  return mpca_tag(mpc_apply(p, mpcf_str_ast), "regex");
+  return mpca_tag(p, "regex");
 }
 
 static int is_number(const char* s) {
@@ -2748,6 +3810,7 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
       if (st->parsers[st->parsers_num-1] == NULL) {
         return mpc_failf("No Parser in position %i! Only supplied %i Parsers!", i, st->parsers_num);
       }
+      if (!st->parsers[st->parsers_num-1]->id) { st->parsers[st->parsers_num-1]->id = st->parsers_num; }
     }
     
     return st->parsers[st->parsers_num-1];
@@ -2774,6 +3837,8 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
         return mpc_failf("Unknown Parser '%s'!", x);
       }
       
+      if (!p->id) { p->id = st->parsers_num; }
+      
       if (p->name && strcmp(p->name, x) == 0) { return p; }
       
     }
@@ -2782,14 +3847,27 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
   
 }
 
+int mpc_rule_id(mpc_parser_t *p) {
+  return p->id;
+}
+
+static mpc_val_t *mpcaf_grammar_rule(mpc_val_t *x, void *s) {
+  mpc_parser_t *p = s;
+  mpc_ast_t *a = mpc_ast_add_tag(x, p->name);
+  if (a && a->rule == 0) { a->rule = p->id; }
+  return a;
+}
+
 static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
   
   mpca_grammar_st_t *st = s;
   mpc_parser_t *p = mpca_grammar_find_parser(x, st);
+  mpc_parser_t *q;
   free(x);
 
   if (p->name) {
-    return mpca_root(mpca_add_tag(p, p->name));
+    q = mpca_root(mpc_apply_to(p, mpcaf_grammar_rule, p));
+    return (st->flags & MPC_LANG_PACKRAT) ? mpca_packrat_key(q, p) : q;
   } else {
     return mpca_root(p);
   }
@@ -123,6 +123,17 @@ mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...);
 
 mpc_parser_t *mpc_predictive(mpc_parser_t *a);
 
+/*
+** A span gives the text its parser matched, copied
+** from the input once it returns, and builds none of
+** the parser's own results on the way. Without any
+** backtracking this is all the input it consumed. A
+** skip matches the same way but gives NULL.
+*/
+
+mpc_parser_t *mpc_span(mpc_parser_t *a);
+mpc_parser_t *mpc_skip(mpc_parser_t *a);
+
 /*
 ** Common Parsers
 */
@@ -233,19 +244,37 @@ mpc_val_t *mpcf_maths(int n, mpc_val_t** xs);
 ** Regular Expression Parsers
 */
 
+/*
+** Regexes made only of characters, ranges, groups,
+** alternatives and repetitions are compiled into a
+** DFA, which matches the whole span in one step when
+** parsing a string. Anything else, and any input it
+** can't settle on its own, uses the combinators.
+*/
+
 mpc_parser_t *mpc_re(const char *re);
   
 /*
 ** AST
 */
 
+/*
+** Nodes built by mpca_lang rules carry the id of the innermost rule
+** which matched them in `rule`, or 0 if none did. A rule's id is the
+** position of its parser among the arguments, counting from 1, and
+** is given by `mpc_rule_id` once mpca_lang has returned.
+*/
+
 typedef struct mpc_ast_t {
   char *tag;
   char *contents;
   int children_num;
   struct mpc_ast_t** children;
+  int rule;
 } mpc_ast_t;
 
+int mpc_rule_id(mpc_parser_t *p);
+
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
 mpc_ast_t *mpc_ast_build(int n, const char *tag, ...);
 mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a);
@@ -264,6 +293,7 @@ mpc_val_t *mpcf_str_ast(mpc_val_t *c);
 mpc_parser_t *mpca_tag(mpc_parser_t *a, const char *t);
 mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t);
 mpc_parser_t *mpca_root(mpc_parser_t *a);
+mpc_parser_t *mpca_span(mpc_parser_t *a);
 mpc_parser_t *mpca_total(mpc_parser_t *a);
 
 mpc_parser_t *mpca_not(mpc_parser_t *a);
@@ -276,12 +306,40 @@ mpc_parser_t *mpca_count(int n, mpc_parser_t *a);
 mpc_parser_t *mpca_or(int n, ...);
 mpc_parser_t *mpca_and(int n, ...);
 
+mpc_parser_t *mpca_packrat(mpc_parser_t *a);
+
+/*
+** With MPC_LANG_PACKRAT every rule of the grammar
+** is wrapped by `mpca_packrat`, which remembers the
+** result of its parser at each input position so
+** that backtracking never parses it there twice.
+** Results are cached until `mpc_packrat_limit` bytes
+** are used, counting the cache's own table. A parse
+** with one of the `_stats` variants also counts them
+** for just that parse.
+*/
+
 enum {
   MPC_LANG_DEFAULT              = 0,
   MPC_LANG_PREDICTIVE           = 1,
-  MPC_LANG_WHITESPACE_SENSITIVE = 2
+  MPC_LANG_WHITESPACE_SENSITIVE = 2,
+  MPC_LANG_PACKRAT              = 4
 };
 
+typedef struct {
+  long hits;
+  long misses;
+  long entries;
+  long bytes;
+  long uncached;
+} mpc_packrat_stats_t;
+
+void mpc_packrat_limit(long bytes);
+int mpc_parse_stats(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, mpc_packrat_stats_t *s);
+int mpc_parse_file_stats(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r, mpc_packrat_stats_t *s);
+int mpc_parse_pipe_stats(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r, mpc_packrat_stats_t *s);
+int mpc_parse_contents_stats(const char *filename, mpc_parser_t *p, mpc_result_t *r, mpc_packrat_stats_t *s);
+
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
 
 mpc_err_t *mpca_lang(int flags, const char *language, ...);
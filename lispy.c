@@ -1,5 +1,135 @@
+/* For MAP_ANONYMOUS under strict C99 */
+#define _DEFAULT_SOURCE
 #include "lispy.h"
 
+#if LJIT_ENABLE
+#include <sys/mman.h>
+#endif
+
+/* Live object counts and the size at which to collect next */
+static long lgc_nvals = 0;
+static long lgc_nenvs = 0;
+static long lgc_next  = LGC_MIN_HEAP;
+
+/* The global environment, which roots every collection */
+static lenv* lgc_root = NULL;
+
+/* Bumped whenever a global is bound, invalidating cached global lookups */
+static unsigned long lenv_epoch = 1;
+
+/* Print the compiled code of each lambda as it is created */
+static int lvm_dump = 0;
+
+/* Size classes for fixed-size nodes */
+static lslab lslab_vals  = { sizeof(lval), NULL, NULL, NULL, NULL, 0, 0, 0 };
+static lslab lslab_nums  = { LVAL_NUM_SIZE, NULL, NULL, NULL, NULL, 0, 0, 0 };
+static lslab lslab_lists = { sizeof(lval) + sizeof(lval*) * LVAL_INLINE, NULL, NULL, NULL, NULL, 0, 0, 0 };
+static lslab lslab_envs  = { sizeof(lenv), NULL, NULL, NULL, NULL, 0, 0, 0 };
+static lslab lslab_frames = { LENV_FRAME_SIZE, NULL, NULL, NULL, NULL, 0, 0, 0 };
+
+/* Size classes lvals are allocated from, all walked by the collector */
+static lslab* lgc_slabs[] = { &lslab_vals, &lslab_nums, &lslab_lists };
+#define LGC_SLABS ((int)(sizeof(lgc_slabs) / sizeof(lgc_slabs[0])))
+
+/* Free nodes are chained through their last word, leaving the first,
+*  where an lval keeps its type, for marking them free */
+#define LSLAB_LINK(s, p) (*(void**)((char*)(p) + (s)->size - sizeof(void*)))
+
+/* Allocate a node from a size class */
+void* lslab_alloc(lslab* s) {
+    s->live++;
+#if LSLAB_ENABLE
+    /* Reuse a freed node if there is one */
+    if (s->free) {
+        void* p = s->free;
+        s->free = LSLAB_LINK(s, p);
+        s->hits++;
+        return p;
+    }
+
+    /* Otherwise carve one from the current slab, starting a new one if full */
+    s->misses++;
+    if (s->next == s->end) {
+        lslab_hdr* h = malloc(sizeof(lslab_hdr) + s->size * LSLAB_NODES);
+        h->prev = NULL;
+        h->next = s->slabs;
+        s->slabs = h;
+        s->next = (char*)(h + 1);
+        s->end = s->next + s->size * LSLAB_NODES;
+    }
+    void* p = s->next;
+    s->next += s->size;
+    return p;
+#else
+    /* Each node has a header of its own so it can still be walked */
+    s->misses++;
+    lslab_hdr* h = malloc(sizeof(lslab_hdr) + s->size);
+    h->prev = NULL;
+    h->next = s->slabs;
+    if (s->slabs) { s->slabs->prev = h; }
+    s->slabs = h;
+    return h + 1;
+#endif
+}
+
+/* Return a node to its size class */
+void lslab_free(lslab* s, void* p) {
+    s->live--;
+#if LSLAB_ENABLE
+    LSLAB_LINK(s, p) = s->free;
+    s->free = p;
+#else
+    lslab_hdr* h = (lslab_hdr*)p - 1;
+    if (h->prev) { h->prev->next = h->next; } else { s->slabs = h->next; }
+    if (h->next) { h->next->prev = h->prev; }
+    free(h);
+#endif
+}
+
+/* Start a walk over every node of a size class, free or not */
+void lslab_walk(lslab* s, lslab_cursor* c) {
+    c->h = s->slabs;
+#if LSLAB_ENABLE
+    /* The newest slab is only carved up to `next` */
+    c->p = c->h ? (char*)(c->h + 1) : NULL;
+    c->end = s->next;
+#endif
+}
+
+/* Get the next node of a walk, or NULL after the last. The node given
+*  may be freed before stepping again */
+void* lslab_step(lslab* s, lslab_cursor* c) {
+#if LSLAB_ENABLE
+    while (c->h && c->p == c->end) {
+        c->h = c->h->next;
+        if (c->h) {
+            c->p = (char*)(c->h + 1);
+            c->end = c->p + s->size * LSLAB_NODES;
+        }
+    }
+    if (!c->h) { return NULL; }
+    void* p = c->p;
+    c->p += s->size;
+    return p;
+#else
+    if (!c->h) { return NULL; }
+    void* p = c->h + 1;
+    c->h = c->h->next;
+    return p;
+#endif
+}
+
+/* Intern table of symbol names, open addressed. Each name is the
+*  `name` member of an lsym so it can carry binding information */
+static char** lsym_table = NULL;
+static unsigned long lsym_count = 0;
+static unsigned long lsym_size = 0;
+
+/* Interned names of the variadic marker, lambda and if */
+static char* lsym_amp = NULL;
+static char* lsym_lambda = NULL;
+static char* lsym_if = NULL;
+
 /* Get the type of a value */
 char* ltype_name(int t) {
     switch(t) {
@@ -10,98 +140,261 @@ char* ltype_name(int t) {
         case LVAL_SEXPR: return "S-Expression";
         case LVAL_QEXPR: return "Q-Expression";
         case LVAL_STR: return "String";
+        case LVAL_CODE: return "Code";
+        case LVAL_MEMO: return "Memo";
         default: return "Unknown type";
     }
 }
 
+/* Get the size class for lvals of a type. Numbers are cut short after
+*  `num`, and lists have room for their first few elements after the
+*  node, so other values stay small */
+static lslab* lval_slab(int type) {
+    if (type == LVAL_NUM) { return &lslab_nums; }
+    return type == LVAL_SEXPR || type == LVAL_QEXPR ? &lslab_lists : &lslab_vals;
+}
+
+/* Allocate an lval of a type on the heap */
+lval* lval_alloc(int type) {
+    lval* v = lslab_alloc(lval_slab(type));
+    v->type = type;
+    v->mark = 0;
+    lgc_nvals++;
+    return v;
+}
+
+/* Free an lval, marking it so the collector's walk passes over it */
+void lval_free(lval* v) {
+    lslab* s = lval_slab(v->type);
+    v->type = LVAL_FREE;
+    lgc_nvals--;
+    lslab_free(s, v);
+}
+
+/* Allocate an lenv, with inline slots after it if it's a frame */
+lenv* lenv_alloc(int frame) {
+    lgc_nenvs++;
+    lenv* e = lslab_alloc(frame ? &lslab_frames : &lslab_envs);
+    e->frame = frame;
+    return e;
+}
+
+/* Free an lenv */
+void lenv_free(lenv* e) {
+    lgc_nenvs--;
+    lslab_free(e->frame ? &lslab_frames : &lslab_envs, e);
+}
+
+/* Shared numbers in [LFIX_MIN, LFIX_MAX], kept outside the heap */
+static lval lfix_cache[LFIX_MAX - LFIX_MIN + 1];
+
+/* Set up the shared numbers */
+void lfix_init(void) {
+    for (long x = LFIX_MIN; x <= LFIX_MAX; x++) {
+        lval* v = &lfix_cache[x - LFIX_MIN];
+        v->type = LVAL_NUM;
+        /* The cache holds a reference so these are never freed */
+        v->refs = 1;
+        /* Always treated as reachable by the collector */
+        v->mark = 1;
+        v->num  = x;
+    }
+}
+
 /* Create a new lval number */
 lval* lval_num(long x) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_NUM;
+    /* Small numbers are shared rather than allocated */
+    if (x >= LFIX_MIN && x <= LFIX_MAX) {
+        return lval_ref(&lfix_cache[x - LFIX_MIN]);
+    }
+
+    lval* v = lval_alloc(LVAL_NUM);
+    v->refs = 1;
     v->num  = x;
     return v;
 }
 
 /* Create a new lval error */
-lval* lval_err(char* fmt, ...) {
-    lval* v = malloc(sizeof(lval));
-    v->type  = LVAL_ERR;
-
-    /* Create a va list and init it */
+lval* lval_err(int code, char* fmt, ...) {
+    lval* v = lval_alloc(LVAL_ERR);
+    v->refs  = 1;
+    v->ecode = code;
+    v->rendered = 0;
+    v->fmt   = fmt;
+
+    /* Keep the raw arguments, reading each as its specifier says */
     va_list va;
     va_start(va, fmt);
+    int n = 0;
+    for (char* p = fmt; *p && n < LERR_ARGS_MAX; p++) {
+        if (*p != '%') { continue; }
+        if (*++p == 'l') { v->eargs[n++].i = va_arg(va, long); p++; }
+        else if (*p == 'i') { v->eargs[n++].i = va_arg(va, int); }
+        else if (*p == 's') { v->eargs[n++].s = va_arg(va, char*); }
+        if (!*p) { break; }
+    }
+    va_end(va);
 
-    /* Allocate 512 bytes of space */
-    v->err = malloc(512);
+    return v;
+}
 
-    /* Printf into the error string with a max of 511 chars */
-    vsnprintf(v->err, 511, fmt, va);
+/* Get the message of an error, rendering it the first time */
+char* lval_err_msg(lval* v) {
+    if (v->rendered) { return v->err; }
+
+    /* Print into a buffer with a max of 511 chars */
+    char buf[512];
+    int len = 0;
+    int n = 0;
+    for (char* p = v->fmt; *p && len < 511; p++) {
+        if (*p != '%') {
+            buf[len++] = *p;
+            continue;
+        }
+        if (*++p == 'l') { p++; }
+        if (*p == 'i') { len += snprintf(buf + len, 512 - len, "%li", v->eargs[n++].i); }
+        else if (*p == 's') { len += snprintf(buf + len, 512 - len, "%s", v->eargs[n++].s); }
+        else if (*p == '%') { buf[len++] = '%'; }
+        else { break; }
+    }
+    if (len > 511) { len = 511; }
+    buf[len] = '\0';
+
+    /* Keep just the bytes used, in place of the format */
+    v->err = malloc(len + 1);
+    memcpy(v->err, buf, len + 1);
+    v->rendered = 1;
+    return v->err;
+}
 
-    /* Reallocate to actual number of bytes used */
-    v->err = realloc(v->err, strlen(v->err)+1);
+/* Hash a symbol name */
+static unsigned long lsym_hash(char* s) {
+    unsigned long h = 5381;
+    while (*s) { h = h * 33 + (unsigned char)*s++; }
+    return h;
+}
 
-    /* Cleanup our va list */
-    va_end(va);
+/* Get the single shared copy of a symbol name, so that symbols
+*  can be compared by pointer rather than by string */
+char* lsym_intern(char* s) {
+    /* Grow the table so it's at most half full */
+    if (lsym_count * 2 >= lsym_size) {
+        unsigned long size = lsym_size ? lsym_size * 2 : 256;
+        char** table = calloc(size, sizeof(char*));
+        for (unsigned long i = 0; i < lsym_size; i++) {
+            if (!lsym_table[i]) { continue; }
+            unsigned long j = lsym_hash(lsym_table[i]) & (size - 1);
+            while (table[j]) { j = (j + 1) & (size - 1); }
+            table[j] = lsym_table[i];
+        }
+        free(lsym_table);
+        lsym_table = table;
+        lsym_size = size;
+    }
 
-    return v;
+    /* Probe for the name, adding it at the first empty slot */
+    unsigned long i = lsym_hash(s) & (lsym_size - 1);
+    while (lsym_table[i]) {
+        if (strcmp(lsym_table[i], s) == 0) { return lsym_table[i]; }
+        i = (i + 1) & (lsym_size - 1);
+    }
+    lsym* n = malloc(sizeof(lsym) + strlen(s) + 1);
+    n->locals = 0;
+    strcpy(n->name, s);
+    lsym_table[i] = n->name;
+    lsym_count++;
+    return lsym_table[i];
 }
 
 /* Create a new lval symbol */
 lval* lval_sym(char* s) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SYM;
-    v->sym  = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
+    lval* v = lval_alloc(LVAL_SYM);
+    v->refs = 1;
+    v->sym  = lsym_intern(s);
+    v->depth = -1;
+    v->slot  = -1;
+    v->gslot = -1;
     return v;
 }
 
 /* Create a new lval sexpr */
 lval* lval_sexpr(void) {
-    lval* v  = malloc(sizeof(lval));
-    v->type  = LVAL_SEXPR;
+    lval* v  = lval_alloc(LVAL_SEXPR);
+    v->refs  = 1;
     v->count = 0;
-    v->cell  = NULL;
+    v->cell  = LVAL_INL(v);
+    v->cells = NULL;
     return v;
 }
 
 /* Create a new lval qexpr */
 lval* lval_qexpr(void) {
-    lval* v  = malloc(sizeof(lval));
-    v->type  = LVAL_QEXPR;
+    lval* v  = lval_alloc(LVAL_QEXPR);
+    v->refs  = 1;
     v->count = 0;
-    v->cell  = NULL;
+    v->cell  = LVAL_INL(v);
+    v->cells = NULL;
     return v;
 }
 
 /* Create a new lval function */
 lval* lval_fun(lbuiltin func) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+    lval* v = lval_alloc(LVAL_FUN);
+    v->refs = 1;
     v->builtin  = func;
     return v;
 }
 
 /* Create a new lval lambda */
 lval* lval_lambda(lval* formals, lval* body) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+    lval* v = lval_alloc(LVAL_FUN);
+    v->refs = 1;
     
     /* Set Builtin to Null */
     v->builtin = NULL;
     
-    /* Built new environment */
-    v->env = lenv_new();
-    
-    /* Set Formals and Body */
+    /* Set Formals and Body, compiled later if at all */
     v->formals = formals;
     v->body = body;
+    v->code = NULL;
+    v->base = NULL;
+    v->args = NULL;
+    return v;
+}
+
+/* Create a memoised function, caching up to `max` results of `f` and
+*  taking ownership of it */
+lval* lval_memo(lval* f, int max) {
+    lval* c = lval_alloc(LVAL_MEMO);
+    c->refs = 1;
+    c->memo = malloc(sizeof(lmemo));
+    c->memo->entries = NULL;
+    c->memo->count = 0;
+    c->memo->size = 0;
+    c->memo->max = max;
+    c->memo->buckets = NULL;
+    c->memo->nbuckets = 0;
+    c->memo->first = -1;
+    c->memo->last = -1;
+    c->memo->hits = 0;
+    c->memo->misses = 0;
+    c->memo->evictions = 0;
+
+    lval* v = lval_alloc(LVAL_FUN);
+    v->refs = 1;
+    v->builtin = NULL;
+    v->formals = f->builtin ? lval_qexpr() : lval_ref(f->formals);
+    v->body = f->builtin ? lval_qexpr() : lval_ref(f->body);
+    v->code = NULL;
+    v->base = f;
+    v->args = c;
     return v;
 }
 
 /* Create a new lval string */
 lval* lval_str(char* s) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_STR;
+    lval* v = lval_alloc(LVAL_STR);
+    v->refs = 1;
     v->str  = malloc(strlen(s) + 1);
     strcpy(v->str, s);
     return v;
@@ -109,99 +402,297 @@ lval* lval_str(char* s) {
 
 /* Create a new lenv */
 lenv* lenv_new(void) {
-    lenv* e  = malloc(sizeof(lenv));
+    lenv* e  = lenv_alloc(0);
     e->par   = NULL;
     e->count = 0;
+    e->size  = 0;
     e->syms  = NULL;
     e->vals  = NULL;
+    e->index = NULL;
+    e->index_size = 0;
+    return e;
+}
+
+/* Create a new activation frame, binding into its inline slots first */
+lenv* lenv_frame(void) {
+    lenv* e  = lenv_alloc(1);
+    e->par   = NULL;
+    e->count = 0;
+    e->size  = LENV_INLINE;
+    e->syms  = LENV_ISYMS(e);
+    e->vals  = LENV_IVALS(e);
+    e->index = NULL;
+    e->index_size = 0;
     return e;
 }
 
+/* Check whether an lenv's bindings are still in its inline slots */
+static int lenv_inline(lenv* e) {
+    return e->frame && e->syms == LENV_ISYMS(e);
+}
+
 /* Delete an lenv */
 void lenv_del(lenv* e) {
+    lenv_unbind(e);
     for (int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
         lval_del(e->vals[i]);
     }
 
-    free(e->syms);
-    free(e->vals);
-    free(e);
+    if (!lenv_inline(e)) {
+        free(e->syms);
+        free(e->vals);
+    }
+    free(e->index);
+    lenv_free(e);
+}
+
+/* Forget the local bindings of an lenv that is going away */
+void lenv_unbind(lenv* e) {
+    if (e == lgc_root) { return; }
+    for (int i = 0; i < e->count; i++) {
+        LSYM(e->syms[i])->locals--;
+    }
 }
 
-/* Copy an lenv */
-lenv* lenv_copy(lenv* e) {
-    lenv* n = malloc(sizeof(lenv));
-    n->par = e->par;
-    n->count = e->count;
-    n->syms = malloc(sizeof(char*) * n->count);
-    n->vals = malloc(sizeof(lval*) * n->count);
+/* Hash an interned symbol name by its address */
+static unsigned long lenv_hash(char* sym) {
+    return ((unsigned long)sym >> 3) * 2654435761UL;
+}
+
+/* Rebuild the hash index of a large lenv, sized to stay at most half full */
+void lenv_index(lenv* e) {
+    int size = 16;
+    while (size < e->count * 2 + 2) { size *= 2; }
+    free(e->index);
+    e->index = calloc(size, sizeof(int));
+    e->index_size = size;
+
+    /* Index entries hold slot + 1 so that zero marks an empty entry */
     for (int i = 0; i < e->count; i++) {
-        n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-        strcpy(n->syms[i], e->syms[i]);
-        n->vals[i] = lval_copy(e->vals[i]);
+        unsigned long j = lenv_hash(e->syms[i]) & (size - 1);
+        while (e->index[j]) { j = (j + 1) & (size - 1); }
+        e->index[j] = i + 1;
     }
-    return n;
 }
 
-/* Delete an lval */
+/* Find the slot of a symbol in a single lenv, or -1 if it isn't bound */
+int lenv_find(lenv* e, char* sym) {
+    /* Small lenvs are scanned directly */
+    if (!e->index) {
+        for (int i = 0; i < e->count; i++) {
+            if (e->syms[i] == sym) { return i; }
+        }
+        return -1;
+    }
+
+    /* Large lenvs probe their index */
+    unsigned long j = lenv_hash(sym) & (e->index_size - 1);
+    while (e->index[j]) {
+        if (e->syms[e->index[j] - 1] == sym) { return e->index[j] - 1; }
+        j = (j + 1) & (e->index_size - 1);
+    }
+    return -1;
+}
+
+/* Take another reference to an lval */
+lval* lval_ref(lval* v) {
+    v->refs++;
+    return v;
+}
+
+/* Drop a reference to an lval, deleting it once no references remain */
 void lval_del(lval* v) {
+    if (--v->refs > 0) { return; }
+
     switch (v->type) {
       case LVAL_NUM: break;
       case LVAL_FUN: 
         if (!v->builtin) {
-          lenv_del(v->env);
           lval_del(v->formals);
           lval_del(v->body);
+          if (v->code) { lval_del(v->code); }
+          if (v->base) {
+            lval_del(v->base);
+            lval_del(v->args);
+          }
+        }
+      break;
+      case LVAL_CODE:
+        free(v->ins);
+        lval_del(v->consts);
+#if LJIT_ENABLE
+        if (v->jit) { ljit_free(v->jit); }
+#endif
+      break;
+      case LVAL_MEMO:
+        for (int i = 0; i < v->memo->count; i++) {
+          lval_del(v->memo->entries[i].key);
+          lval_del(v->memo->entries[i].val);
         }
+        free(v->memo->entries);
+        free(v->memo->buckets);
+        free(v->memo);
       break;
-      case LVAL_ERR: free(v->err); break;
-      case LVAL_SYM: free(v->sym); break;
+      case LVAL_ERR: if (v->rendered) { free(v->err); } break;
+      case LVAL_SYM: break;
       case LVAL_QEXPR:
       case LVAL_SEXPR:
-        for (int i = 0; i < v->count; i++) {
-          lval_del(v->cell[i]);
+        if (v->cells) {
+          lcells_del(v->cells);
+        } else {
+          for (int i = 0; i < v->count; i++) { lval_del(v->cell[i]); }
         }
-        free(v->cell);
       break;
       case LVAL_STR: free(v->str); break;
     }
     
-    free(v);
+    lval_free(v);
+}
+
+/* Allocate an unshared cell buffer with room for `size` elements */
+lcells* lcells_new(int size) {
+    lcells* c = malloc(sizeof(lcells) + sizeof(lval*) * size);
+    c->refs = 1;
+    c->mark = 0;
+    c->lo = 0;
+    c->used = 0;
+    c->size = size;
+    return c;
+}
+
+/* Drop a reference to a cell buffer, deleting the elements it owns
+*  once no lists view it */
+void lcells_del(lcells* c) {
+    if (--c->refs > 0) { return; }
+    for (int i = c->lo; i < c->used; i++) {
+        if (c->items[i]) { lval_del(c->items[i]); }
+    }
+    free(c);
+}
+
+/* Give a list sole use of storage holding exactly its elements, with
+*  room for `extra` more after them, copying if the buffer is shared */
+void lval_cells_own(lval* v, int extra) {
+    lcells* c = v->cells;
+
+    if (!c) {
+        /* Inline elements are always ours, they may just need compacting */
+        if (v->cell + v->count + extra <= LVAL_INL(v) + LVAL_INLINE) { return; }
+        if (v->count + extra <= LVAL_INLINE) {
+            memmove(LVAL_INL(v), v->cell, sizeof(lval*) * v->count);
+            v->cell = LVAL_INL(v);
+            return;
+        }
+    } else if (c->refs == 1 && v->cell == c->items + c->lo
+        && v->cell + v->count == c->items + c->used) {
+        /* Our own buffer only needs to grow, which it does geometrically */
+        if (c->used + extra <= c->size) { return; }
+        long off = v->cell - c->items;
+        c->size = c->size * 2 > c->used + extra ? c->size * 2 : c->used + extra;
+        c = realloc(c, sizeof(lcells) + sizeof(lval*) * c->size);
+        v->cells = c;
+        v->cell = c->items + off;
+        return;
+    }
+
+    /* Otherwise move to a fresh buffer with room to grow */
+    int size = v->count * 2 > v->count + extra ? v->count * 2 : v->count + extra;
+    lcells* n = lcells_new(size);
+    for (int i = 0; i < v->count; i++) {
+        /* Inline references move over, shared ones are taken again */
+        n->items[i] = c ? lval_ref(v->cell[i]) : v->cell[i];
+    }
+    n->used = v->count;
+    if (c) { lcells_del(c); }
+    v->cells = n;
+    v->cell = n->items;
+}
+
+/* Get a privately owned lval that is safe to mutate in place */
+lval* lval_own(lval* v) {
+    /* Sole owner can mutate directly */
+    if (v->refs == 1) { return v; }
+
+    /* Otherwise swap our reference for a fresh copy */
+    lval* x = lval_copy(v);
+    v->refs--;
+    return x;
 }
 
 /* Add an element to an sexpr */
 lval* lval_add(lval* v, lval* x) {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    v->cell[v->count-1] = x;
+    lcells* c = v->cells;
+
+    /* Elements past the end of the buffer's used region are invisible to
+    *  other lists sharing it, so a list ending there can append in place */
+    if (c && v->cell + v->count == c->items + c->used && c->used < c->size) {
+        c->items[c->used++] = x;
+        v->count++;
+        return v;
+    }
+
+    /* Otherwise make room in storage of our own */
+    lval_cells_own(v, 1);
+    if (v->cells) { v->cells->used++; }
+    v->cell[v->count++] = x;
     return v;
 }
 
-/* Copys an lval into a new lval */
+/* Copys an lval into a new lval, sharing its children */
 lval* lval_copy(lval* v) {
-    lval* x = malloc(sizeof(lval));
-    x->type = v->type;
+    /* Numbers are never modified, so small ones stay shared */
+    if (v->type == LVAL_NUM) { return lval_num(v->num); }
+
+    lval* x = lval_alloc(v->type);
+    x->refs = 1;
     switch (v->type) {
       case LVAL_FUN:
         if (v->builtin) {
           x->builtin = v->builtin;
         } else {
           x->builtin = NULL;
-          x->env = lenv_copy(v->env);
-          x->formals = lval_copy(v->formals);
-          x->body = lval_copy(v->body);
+          x->formals = lval_ref(v->formals);
+          x->body = lval_ref(v->body);
+          x->code = v->code ? lval_ref(v->code) : NULL;
+          x->base = v->base ? lval_ref(v->base) : NULL;
+          x->args = v->args ? lval_ref(v->args) : NULL;
         }
       break;
-      case LVAL_NUM: x->num = v->num; break;
-      case LVAL_ERR: x->err = malloc(strlen(v->err) + 1); strcpy(x->err, v->err); break;
-      case LVAL_SYM: x->sym = malloc(strlen(v->sym) + 1); strcpy(x->sym, v->sym); break;
+      case LVAL_CODE:
+        x->ins = malloc(sizeof(lins) * v->ins_count);
+        memcpy(x->ins, v->ins, sizeof(lins) * v->ins_count);
+        x->ins_count = v->ins_count;
+        x->stack = v->stack;
+        x->consts = lval_ref(v->consts);
+        x->jit = NULL;
+        x->calls = 0;
+      break;
+      case LVAL_ERR:
+        x->ecode = v->ecode;
+        x->rendered = v->rendered;
+        x->fmt = v->fmt;
+        memcpy(x->eargs, v->eargs, sizeof(v->eargs));
+        if (v->rendered) { x->err = malloc(strlen(v->err) + 1); strcpy(x->err, v->err); }
+      break;
+      case LVAL_SYM:
+        x->sym = v->sym;
+        x->depth = v->depth;
+        x->slot = v->slot;
+        x->gslot = v->gslot;
+      break;
       case LVAL_SEXPR:
       case LVAL_QEXPR:
         x->count = v->count;
-        x->cell = malloc(sizeof(lval*) * x->count);
-        for (int i = 0; i < x->count; i++) {
-          x->cell[i] = lval_copy(v->cell[i]);
+        if (v->cells) {
+          /* Share the cell buffer, it is copied on write */
+          x->cell = v->cell;
+          x->cells = v->cells;
+          x->cells->refs++;
+        } else {
+          /* Inline elements are few, so just copy them */
+          x->cell = LVAL_INL(x);
+          x->cells = NULL;
+          for (int i = 0; i < x->count; i++) { x->cell[i] = lval_ref(v->cell[i]); }
         }
       break;
       case LVAL_STR: x->str = malloc(strlen(v->str) + 1); strcpy(x->str, v->str); break;
@@ -209,19 +700,223 @@ lval* lval_copy(lval* v) {
     return x;
 }
 
+/* Calls `f` on every lval directly referenced by `v` */
+static void lgc_each_child(lval* v, void (*f)(lval*)) {
+    switch (v->type) {
+      case LVAL_FUN:
+        if (!v->builtin) {
+          f(v->formals);
+          f(v->body);
+          if (v->code) { f(v->code); }
+          if (v->base) {
+            f(v->base);
+            f(v->args);
+          }
+        }
+      break;
+      case LVAL_CODE: f(v->consts); break;
+      case LVAL_MEMO:
+        for (int i = 0; i < v->memo->count; i++) {
+          f(v->memo->entries[i].key);
+          f(v->memo->entries[i].val);
+        }
+      break;
+      case LVAL_SEXPR:
+      case LVAL_QEXPR:
+        /* Buffered elements belong to the buffer, which may be shared by
+        *  several lists, so visit each buffer once. Cells are briefly
+        *  NULL while being evaluated */
+        if (!v->cells) {
+          for (int i = 0; i < v->count; i++) {
+            if (v->cell[i]) { f(v->cell[i]); }
+          }
+        } else if (!v->cells->mark) {
+          v->cells->mark = 1;
+          for (int i = v->cells->lo; i < v->cells->used; i++) {
+            if (v->cells->items[i]) { f(v->cells->items[i]); }
+          }
+        }
+      break;
+    }
+}
+
+/* Clear the visited flag of a list's buffer */
+static void lgc_unvisit(lval* v) {
+    if ((v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) && v->cells) {
+        v->cells->mark = 0;
+    }
+}
+
+/* Mark stack shared by the collector's helpers */
+static lval** lgc_stack = NULL;
+static long lgc_stack_count = 0;
+static long lgc_stack_size = 0;
+
+static void lgc_uncount(lval* v) { v->gc_refs--; }
+
+static void lgc_push(lval* v) {
+    if (v->mark) { return; }
+    v->mark = 1;
+    if (lgc_stack_count == lgc_stack_size) {
+        lgc_stack_size = lgc_stack_size ? lgc_stack_size * 2 : 256;
+        lgc_stack = realloc(lgc_stack, sizeof(lval*) * lgc_stack_size);
+    }
+    lgc_stack[lgc_stack_count++] = v;
+}
+
+/* A dead parent releases its reference on any surviving child */
+static void lgc_release(lval* v) {
+    if (v->mark) { v->refs--; }
+}
+
+/* Frees the storage of an unreachable lval without touching its children */
+static void lgc_destroy(lval* v) {
+    switch (v->type) {
+      case LVAL_CODE:
+        free(v->ins);
+#if LJIT_ENABLE
+        if (v->jit) { ljit_free(v->jit); }
+#endif
+      break;
+      case LVAL_MEMO:
+        free(v->memo->entries);
+        free(v->memo->buckets);
+        free(v->memo);
+      break;
+      case LVAL_ERR: if (v->rendered) { free(v->err); } break;
+      case LVAL_QEXPR:
+      case LVAL_SEXPR:
+        /* Only free the buffer once no list views it */
+        if (v->cells && --v->cells->refs == 0) { free(v->cells); }
+      break;
+      case LVAL_STR: free(v->str); break;
+    }
+    lval_free(v);
+}
+
+/* Position of a walk over every size class of lvals */
+typedef struct {
+    int slab;
+    lslab_cursor c;
+} lgc_cursor;
+
+/* Start a walk over the heap */
+static void lgc_walk(lgc_cursor* g) {
+    g->slab = 0;
+    lslab_walk(lgc_slabs[0], &g->c);
+}
+
+/* Get the next live lval of a walk over the heap, or NULL after the last */
+static lval* lgc_step(lgc_cursor* g) {
+    for (;;) {
+        lval* v = lslab_step(lgc_slabs[g->slab], &g->c);
+        if (v) {
+            if (v->type != LVAL_FREE) { return v; }
+            continue;
+        }
+        if (++g->slab == LGC_SLABS) { return NULL; }
+        lslab_walk(lgc_slabs[g->slab], &g->c);
+    }
+}
+
+/* Visit every live lval, which the body may free */
+#define LGC_EACH(g, v) for (lgc_walk(&(g)); ((v) = lgc_step(&(g))); )
+
+/* Set the environment that roots every collection */
+void lgc_set_root(lenv* e) {
+    lgc_root = e;
+}
+
+/* Mark and sweep the lval heap, returning the number of lvals freed.
+*  Roots are the global environment plus, unless `strict` is set, every
+*  lval holding a reference not accounted for by the heap itself, which
+*  is how values owned by the evaluator's C stack are found. A strict
+*  collection is only safe when nothing but the global environment is
+*  live, such as between lines at the top level, and also reclaims
+*  values whose references were leaked. Environments aren't swept, as no
+*  lval refers to one: besides the global environment there are only
+*  activation frames, which lval_call frees as each call returns. */
+long lgc_collect(int strict) {
+    lgc_cursor c;
+    lval* v;
+
+    /* Find references coming from outside the heap */
+    LGC_EACH(c, v) { v->gc_refs = v->refs; }
+    LGC_EACH(c, v) { lgc_each_child(v, lgc_uncount); }
+    LGC_EACH(c, v) { lgc_unvisit(v); }
+
+    /* Mark from the roots */
+    if (lgc_root) {
+        for (int i = 0; i < lgc_root->count; i++) { lgc_push(lgc_root->vals[i]); }
+    }
+    if (!strict) {
+        LGC_EACH(c, v) {
+            if (v->gc_refs > 0) { lgc_push(v); }
+        }
+    }
+    while (lgc_stack_count) {
+        lgc_each_child(lgc_stack[--lgc_stack_count], lgc_push);
+    }
+
+    /* Drop references from dead values into live ones. Buffers
+    *  reached from live lists are still flagged, so are skipped */
+    LGC_EACH(c, v) {
+        if (!v->mark) { lgc_each_child(v, lgc_release); }
+    }
+
+    /* Sweep the dead and reset marks on the living */
+    long freed = 0;
+    LGC_EACH(c, v) {
+        if (v->mark) {
+            v->mark = 0;
+            lgc_unvisit(v);
+        } else {
+            lgc_destroy(v);
+            freed++;
+        }
+    }
+
+    /* Collect again once the heap has doubled */
+    lgc_next = lgc_nvals * 2 > LGC_MIN_HEAP ? lgc_nvals * 2 : LGC_MIN_HEAP;
+    return freed;
+}
+
+/* Run a strict collection if the heap has grown enough to warrant one */
+void lgc_maybe_collect(void) {
+    if (lgc_nvals > lgc_next) { lgc_collect(1); }
+}
+
 /* Gets an lval from an lenv, or an error if it isn't there */
 lval* lenv_get(lenv* e, lval* k) {
-    /* Iterate over each item in the lenv */
-    for (int i = 0; i < e->count; i++) {
-        if (strcmp(e->syms[i], k->sym) == 0) { return lval_copy(e->vals[i]); }
+    lsym* s = LSYM(k->sym);
+
+    /* Try the frame and slot the resolver assigned. Only trust a hit in an
+    *  outer frame if no other local binding could shadow it */
+    if (k->depth >= 0 && (k->depth == 0 || s->locals == 1)) {
+        lenv* f = e;
+        for (int d = 0; d < k->depth && f; d++) { f = f->par; }
+        if (f && k->slot < f->count && f->syms[k->slot] == k->sym) {
+            return lval_ref(f->vals[k->slot]);
+        }
     }
-    
-    /* If no symbol check in parent otherwise error */
-    if (e->par) {
-        return lenv_get(e->par, k);
-    } else {
-        return lval_err("Unbound Symbol '%s'", k->sym);
+
+    /* Symbols with no local bindings anywhere can go straight to the
+    *  global binding, remembering its slot for next time. If there is
+    *  none the symbol is unbound, without walking the chain */
+    if (s->locals == 0 && lgc_root) {
+        if (k->gslot < 0 || k->gslot >= lgc_root->count || lgc_root->syms[k->gslot] != k->sym) {
+            k->gslot = lenv_find(lgc_root, k->sym);
+        }
+        if (k->gslot >= 0) { return lval_ref(lgc_root->vals[k->gslot]); }
+        return lval_err(LERR_UNBOUND, "Unbound Symbol '%s'", k->sym);
+    }
+
+    /* Check each lenv up the parent chain */
+    for (; e; e = e->par) {
+        int i = lenv_find(e, k->sym);
+        if (i >= 0) { return lval_ref(e->vals[i]); }
     }
+    return lval_err(LERR_UNBOUND, "Unbound Symbol '%s'", k->sym);
 }
 
 /* Define a variable globally */
@@ -234,28 +929,54 @@ void lenv_def(lenv* e, lval* k, lval* v) {
 
 /* Puts an lval into the lenv, replacing the value if it already exists */
 void lenv_put(lenv* e, lval* k, lval* v) {
-    /* See if the variable already exists */
-    for (int i = 0; i < e->count; i++) {
-        /* If variable is found, delete it and replace
-        *  with the variable supplied by the user */
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            e->syms[i] = realloc(e->syms[i], strlen(k->sym) + 1);
-            strcpy(e->syms[i], k->sym);
-            return;
-        }
+    lenv_set(e, k->sym, v);
+}
+
+/* Binds an interned symbol name in the lenv */
+void lenv_set(lenv* e, char* sym, lval* v) {
+    /* Global lookups cached so far may now be stale */
+    if (e == lgc_root) { lenv_epoch++; }
+
+    /* If variable is found, delete it and replace
+    *  with the variable supplied by the user */
+    int i = lenv_find(e, sym);
+    if (i >= 0) {
+        lval_del(e->vals[i]);
+        e->vals[i] = lval_ref(v);
+        return;
     }
 
-    /* If it's not found, allocate space for it */
+    /* If it's not found, make space for it, growing geometrically */
+    if (e->count == e->size) {
+        e->size = e->size ? e->size * 2 : LENV_INLINE;
+        if (lenv_inline(e)) {
+            /* Move out of the inline slots */
+            e->vals = malloc(sizeof(lval*) * e->size);
+            e->syms = malloc(sizeof(char*) * e->size);
+            memcpy(e->vals, LENV_IVALS(e), sizeof(lval*) * e->count);
+            memcpy(e->syms, LENV_ISYMS(e), sizeof(char*) * e->count);
+        } else {
+            e->vals = realloc(e->vals, sizeof(lval*) * e->size);
+            e->syms = realloc(e->syms, sizeof(char*) * e->size);
+        }
+    }
     e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
 
-    /* Copy the provided lval and symbol string */
-    e->vals[e->count-1] = lval_copy(v);
-    e->syms[e->count-1] = malloc(strlen(k->sym)+1);
-    strcpy(e->syms[e->count-1], k->sym);
+    /* Share the provided lval and the interned symbol name */
+    e->vals[e->count-1] = lval_ref(v);
+    e->syms[e->count-1] = sym;
+    if (e != lgc_root) { LSYM(sym)->locals++; }
+
+    /* Large lenvs are indexed, rebuilding the index when it fills up */
+    if (e->count > LENV_HASH_MIN) {
+        if (!e->index || e->count * 2 > e->index_size) {
+            lenv_index(e);
+        } else {
+            unsigned long j = lenv_hash(sym) & (e->index_size - 1);
+            while (e->index[j]) { j = (j + 1) & (e->index_size - 1); }
+            e->index[j] = e->count;
+        }
+    }
 }
 
 /* Add a builtin function to an lenv */
@@ -287,6 +1008,10 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "=",   builtin_put);
     lenv_add_builtin(e, "\\",  builtin_lambda);
 
+    /* Memo functions */
+    lenv_add_builtin(e, "memo", builtin_memo);
+    lenv_add_builtin(e, "memo-stats", builtin_memo_stats);
+
     /* Comparison functions */
     lenv_add_builtin(e, "if", builtin_if);
     lenv_add_builtin(e, "==", builtin_eq);
@@ -300,6 +1025,12 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "load", builtin_load);
     lenv_add_builtin(e, "print", builtin_print);
     lenv_add_builtin(e, "error", builtin_error);
+    lenv_add_builtin(e, "error-code", builtin_error_code);
+
+    /* Memory functions */
+    lenv_add_builtin(e, "gc", builtin_gc);
+    lenv_add_builtin(e, "heap", builtin_heap);
+    lenv_add_builtin(e, "slab", builtin_slab);
 }
 
 /* Print an lval expression */
@@ -335,12 +1066,14 @@ void lval_print(lval* v) {
       case LVAL_FUN:
         if (v->builtin) {
           printf("<builtin>");
+        } else if (LFUN_MEMO(v)) {
+          printf("(memo "); lval_print(v->base); putchar(')');
         } else {
           printf("(\\ "); lval_print(v->formals); putchar(' '); lval_print(v->body); putchar(')');
         }
       break;
       case LVAL_NUM:   printf("%li", v->num); break;
-      case LVAL_ERR:   printf("Error: %s", v->err); break;
+      case LVAL_ERR:   printf("Error: %s", lval_err_msg(v)); break;
       case LVAL_SYM:   printf("%s", v->sym); break;
       case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
       case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
@@ -357,7 +1090,7 @@ void lval_println(lval* v) {
 /* Read in a number */
 lval* lval_read_num(mpc_ast_t* t) {
     long x = strtol(t->contents, NULL, 10);
-    return errno != ERANGE ? lval_num(x) : lval_err("Invalid number");
+    return errno != ERANGE ? lval_num(x) : lval_err(LERR_NUMBER, "Invalid number");
 }
 
 /* Read in a string */
@@ -365,7 +1098,7 @@ lval* lval_read_str(mpc_ast_t* t) {
     /* Cut off the final quote character */
     t->contents[strlen(t->contents)-1] = '\0';
     /* Copy the string missing out the first quote character */
-    char* unescaped = malloc(strlen(t->contents+1));
+    char* unescaped = malloc(strlen(t->contents+1) + 1);
     strcpy(unescaped, t->contents+1);
     /* Pass through the unescape function */
     unescaped = mpcf_unescape(unescaped);
@@ -376,190 +1109,1381 @@ lval* lval_read_str(mpc_ast_t* t) {
     return str;
 }
 
-/* Read in the AST */
-lval* lval_read(mpc_ast_t* t) {
-    /* If sym or num, convert to that type */
-    if (strstr(t->tag, "number")) { return lval_read_num(t); }
-    if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
+/* Grammar rule of each id mpca_lang gave a parser */
+static int lrule_map[LRULE_IDS];
 
-    /* If str, return the read string */
-    if (strstr(t->tag, "string")) { return lval_read_str(t); }
+/* Map the ids mpca_lang gave the parsers to the rules they read as,
+*  so the order they were passed in doesn't matter */
+void lrule_init(void) {
+    mpc_parser_t* parsers[] = { NULL, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy };
+    for (int r = LRULE_NUMBER; r < LRULE_COUNT; r++) {
+        int id = mpc_rule_id(parsers[r]);
+        if (id > 0 && id < LRULE_IDS) { lrule_map[id] = r; }
+    }
+}
 
-    /* If root (>), sexpr, or qexpr then create an empty list */
-    lval* x = NULL;
-    if (strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
-    if (strstr(t->tag, "sexpr"))  { x = lval_sexpr(); }
-    if (strstr(t->tag, "qexpr"))  { x = lval_qexpr(); }
+/* Get the grammar rule that built an AST node */
+static int lrule_of(mpc_ast_t* t) {
+    return t->rule > 0 && t->rule < LRULE_IDS ? lrule_map[t->rule] : LRULE_NONE;
+}
+
+/* Read in the AST */
+lval* lval_read(mpc_ast_t* t) {
+    /* Dispatch on the innermost rule matching the node. The root (>)
+    *  and sexprs make an empty S-Expression, qexprs a Q-Expression */
+    lval* x;
+    switch (lrule_of(t)) {
+      case LRULE_NUMBER: return lval_read_num(t);
+      case LRULE_SYMBOL: return lval_sym(t->contents);
+      case LRULE_STRING: return lval_read_str(t);
+      case LRULE_QEXPR:  x = lval_qexpr(); break;
+      default:           x = lval_sexpr(); break;
+    }
 
-    /* Fill the list with valid expressions within */
+    /* Fill the list with valid expressions within, skipping brackets
+    *  and anchors, which match no rule, and comments */
     for (int i = 0; i < t->children_num; i++) {
-        if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
-        if (strcmp(t->children[i]->tag, "regex") == 0)  { continue; }
-        /* If comment, ignore */
-        if (strstr(t->children[i]->tag, "comment")) { continue; }
+        int rule = lrule_of(t->children[i]);
+        if (rule == LRULE_NONE || rule == LRULE_COMMENT) { continue; }
         x = lval_add(x, lval_read(t->children[i]));
     }
 
-    return x;
+    return x;
+}
+
+#if LREAD_MPC
+
+/* Read the result of parsing with the grammar, or its error */
+static lval* lread_mpc(int ok, mpc_result_t* r) {
+    if (ok) {
+        lval* x = lval_read(r->output);
+        mpc_ast_delete(r->output);
+        return x;
+    }
+
+    /* Drop the newline the message ends in */
+    char* msg = mpc_err_string(r->error);
+    mpc_err_delete(r->error);
+    int len = strlen(msg);
+    if (len && msg[len - 1] == '\n') { msg[len - 1] = '\0'; }
+
+    lval* err = lval_err(LERR_LOAD, "%s", msg);
+    lval_err_msg(err);
+    free(msg);
+    return err;
+}
+
+#else
+
+/* Position in source being read, and the syntax error if reading failed */
+typedef struct {
+    char* name;
+    char* p;
+    char* line;
+    int row;
+    lval* err;
+} lreader;
+
+/* Fail with a syntax error at the current position */
+static lval* lread_fail(lreader* r, char* msg) {
+    r->err = lval_err(LERR_LOAD, "%s:%i:%i: %s", r->name, r->row, (int)(r->p - r->line) + 1, msg);
+    lval_err_msg(r->err);
+    return NULL;
+}
+
+/* Check for a character of a number, which symbols may contain too */
+static int lread_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+/* Check for a character of a symbol */
+static int lread_symbol(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || lread_digit(c)
+        || (c && strchr("_+-*/\\=<>!&", c));
+}
+
+/* Skip whitespace and comments */
+static void lread_space(lreader* r) {
+    for (;;) {
+        switch (*r->p) {
+          case '\n': r->row++; r->line = ++r->p; break;
+          case ' ': case '\t': case '\r': case '\f': case '\v': r->p++; break;
+          case ';':
+            while (*r->p && *r->p != '\n' && *r->p != '\r') { r->p++; }
+          break;
+          default: return;
+        }
+    }
+}
+
+static lval* lread_expr(lreader* r);
+
+/* Read expressions into `x` until `close`, or the end of the source if
+*  that is '\0'. Returns NULL on a syntax error */
+static lval* lread_list(lreader* r, lval* x, char close) {
+    for (;;) {
+        lread_space(r);
+        char c = *r->p;
+        if (c == close) {
+            if (c) { r->p++; }
+            return x;
+        }
+
+        char msg[64];
+        if (!c) {
+            snprintf(msg, sizeof(msg), "expected '%c' before end of input", close);
+        } else if (c == ')' || c == '}') {
+            snprintf(msg, sizeof(msg), "unexpected '%c'", c);
+        } else {
+            lval* y = lread_expr(r);
+            if (y) {
+                x = lval_add(x, y);
+                continue;
+            }
+            lval_del(x);
+            return NULL;
+        }
+        lval_del(x);
+        return lread_fail(r, msg);
+    }
+}
+
+/* Read a single expression, which isn't a closing bracket */
+static lval* lread_expr(lreader* r) {
+    char* p = r->p;
+
+    if (*p == '(') {
+        r->p++;
+        return lread_list(r, lval_sexpr(), ')');
+    }
+    if (*p == '{') {
+        r->p++;
+        return lread_list(r, lval_qexpr(), '}');
+    }
+
+    /* Strings keep their escapes until the closing quote is found */
+    if (*p == '"') {
+        char* q = p + 1;
+        char* line = r->line;
+        int row = r->row;
+        while (*q != '"') {
+            if (!*q || (*q == '\\' && !q[1])) { return lread_fail(r, "unterminated string"); }
+            if (*q == '\\') { q++; }
+            if (*q == '\n') { row++; line = q + 1; }
+            q++;
+        }
+        r->p = q + 1;
+        r->line = line;
+        r->row = row;
+
+        char* unescaped = malloc(q - p);
+        memcpy(unescaped, p + 1, q - p - 1);
+        unescaped[q - p - 1] = '\0';
+        unescaped = mpcf_unescape(unescaped);
+        lval* str = lval_str(unescaped);
+        free(unescaped);
+        return str;
+    }
+
+    /* Numbers are tried before symbols, so "-1" is a number and "1a"
+    *  a number then a symbol */
+    if (lread_digit(*p) || (*p == '-' && lread_digit(p[1]))) {
+        errno = 0;
+        long x = strtol(p, &r->p, 10);
+        return errno != ERANGE ? lval_num(x) : lval_err(LERR_NUMBER, "Invalid number");
+    }
+
+    /* Symbols are read in place, ending them just while interning */
+    if (lread_symbol(*p)) {
+        char* q = p;
+        while (lread_symbol(*q)) { q++; }
+        char c = *q;
+        *q = '\0';
+        lval* x = lval_sym(p);
+        *q = c;
+        r->p = q;
+        return x;
+    }
+
+    char msg[64];
+    snprintf(msg, sizeof(msg), "unexpected '%c'", *p);
+    return lread_fail(r, msg);
+}
+
+#endif
+
+/* Read every expression in the source `s` into an S-Expression, or give
+*  an error locating the first syntax error. `name` is where it's from */
+lval* lval_read_src(char* name, char* s) {
+#if LREAD_MPC
+    mpc_result_t r;
+    return lread_mpc(mpc_parse(name, s, Lispy, &r), &r);
+#else
+    lreader r = { name, s, s, 1, NULL };
+    lval* x = lread_list(&r, lval_sexpr(), '\0');
+    return x ? x : r.err;
+#endif
+}
+
+/* Read every expression in a file, as lval_read_src */
+lval* lval_read_file(char* filename) {
+#if LREAD_MPC
+    mpc_result_t r;
+    return lread_mpc(mpc_parse_contents(filename, Lispy, &r), &r);
+#else
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        lval* err = lval_err(LERR_LOAD, "%s: Unable to open file!", filename);
+        lval_err_msg(err);
+        return err;
+    }
+
+    /* Read in chunks until EOF, as pipes and some special files can't
+    *  seek or report their size */
+    size_t size = 4096;
+    size_t len = 0;
+    char* s = malloc(size);
+    for (;;) {
+        len += fread(s + len, 1, size - len - 1, f);
+        if (len < size - 1) { break; }
+        size *= 2;
+        s = realloc(s, size);
+    }
+    s[len] = '\0';
+
+    int failed = ferror(f);
+    fclose(f);
+    if (failed) {
+        free(s);
+        lval* err = lval_err(LERR_LOAD, "%s: Unable to read file!", filename);
+        lval_err_msg(err);
+        return err;
+    }
+
+    lval* x = lval_read_src(filename, s);
+    free(s);
+    return x;
+#endif
+}
+
+/* Pops an element at index i from an s-expr, moving the later elements up */
+lval* lval_pop(lval* v, int i) {
+    /* Popping the front just narrows the view */
+    if (i == 0) {
+        lcells* c = v->cells;
+        lval* x = v->cell[0];
+        if (c && c->refs == 1 && v->cell == c->items + c->lo) {
+            /* Nobody else can see it, so hand over the buffer's reference */
+            c->items[c->lo++] = NULL;
+        } else if (c) {
+            lval_ref(x);
+        }
+        v->cell++;
+        v->count--;
+        return x;
+    }
+
+    /* Otherwise make sure the storage is ours before shifting it */
+    lval_cells_own(v, 0);
+
+    /* Find the item at `i` */
+    lval* x = v->cell[i];
+
+    /* Shift the memory following the item at `i` over top it, keeping
+    *  the capacity for later additions */
+    memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));
+
+    /* Decrease count of items */
+    v->count--;
+    if (v->cells) { v->cells->used--; }
+    return x;
+}
+
+/* Pops an element at index i from an s-expr, then deletes the s-expr */
+lval* lval_take(lval* v, int i) {
+    lval* x = lval_pop(v, i);
+    lval_del(v);
+    return x;
+}
+
+/* Evaluate an lval */
+lval* lval_eval(lenv* e, lval* v) {
+    /* Get symbols from the environment */
+    if (v->type == LVAL_SYM) {
+        lval* x = lenv_get(e, v);
+        lval_del(v);
+        return x;
+    }
+    /* Eval s-exprs, which are rewritten in place so must be owned */
+    if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, lval_own(v)); }
+    /* Other types stay the same, so just give them back */
+    return v;
+}
+
+/* Evaluate an s-expr */
+lval* lval_eval_sexpr(lenv* e, lval* v) {
+    return lval_eval_tail(e, v, NULL, NULL);
+}
+
+/* Check that the call form (def {syms} vals...) or (= {syms} vals...)
+*  names one symbol per value, so it can be bound straight from the form */
+static int lval_var_form(lval* v) {
+    lval* syms = v->cell[1];
+    if (syms->type != LVAL_QEXPR || syms->count != v->count - 2) { return 0; }
+    for (int i = 0; i < syms->count; i++) {
+        if (syms->cell[i]->type != LVAL_SYM) { return 0; }
+    }
+    return 1;
+}
+
+/* Evaluate the values of a def or = call form and bind them to its
+*  symbols, globally if `global` is set, without an argument list */
+static lval* lval_eval_var(lenv* e, lval* v, int global) {
+    for (int i = 2; i < v->count; i++) {
+        lval* x = v->cell[i];
+        v->cell[i] = NULL;
+        v->cell[i] = lval_eval(e, x);
+    }
+    for (int i = 2; i < v->count; i++) {
+        if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+    }
+
+    lval* syms = v->cell[1];
+    for (int i = 0; i < syms->count; i++) {
+        if (global) { lenv_def(e, syms->cell[i], v->cell[i+2]); }
+        else { lenv_put(e, syms->cell[i], v->cell[i+2]); }
+    }
+    lval_del(v);
+    return lval_sexpr();
+}
+
+/* Check that the call form (\ {formals} {body}) is a valid lambda */
+static int lval_lambda_form(lval* v) {
+    if (v->count != 3 || v->cell[1]->type != LVAL_QEXPR || v->cell[2]->type != LVAL_QEXPR) { return 0; }
+    for (int i = 0; i < v->cell[1]->count; i++) {
+        if (v->cell[1]->cell[i]->type != LVAL_SYM) { return 0; }
+    }
+    return 1;
+}
+
+/* Evaluate an s-expr in tail position. A lambda call it ends in is not
+*  made but handed back through `tf` and `ta`, returning NULL, so the
+*  caller can make it without nesting. Branches of `if` are evaluated
+*  in place either way */
+lval* lval_eval_tail(lenv* e, lval* v, lval** tf, lval** ta) {
+    for (;;) {
+        /* Children are replaced in place, so the buffer must be ours */
+        if (v->count) { lval_cells_own(v, 0); }
+
+        /* Evaluate the head first, as it may be a special form. Clear
+        *  each cell while its value is in flight */
+        int i = 0;
+        if (v->count > 1) {
+            lval* x = v->cell[0];
+            v->cell[0] = NULL;
+            v->cell[0] = lval_eval(e, x);
+            i = 1;
+
+            lval* h = v->cell[0];
+            lbuiltin b = h->type == LVAL_FUN ? h->builtin : NULL;
+
+            /* Well formed def, = and \ are evaluated straight from the
+            *  call form. Others go to the builtin to report the error */
+            if ((b == builtin_def || b == builtin_put) && lval_var_form(v)) {
+                return lval_eval_var(e, v, b == builtin_def);
+            }
+            if (b == builtin_lambda && lval_lambda_form(v)) {
+                lval* formals = lval_pop(v, 1);
+                lval* body = lval_pop(v, 1);
+                lval_del(v);
+                return lval_lambda_new(formals, body);
+            }
+        }
+
+        /* Evaluate the remaining children */
+        for (; i < v->count; i++) {
+            lval* x = v->cell[i];
+            v->cell[i] = NULL;
+            v->cell[i] = lval_eval(e, x);
+        }
+
+        /* Error checking */
+        for (int i = 0; i < v->count; i++) {
+            if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+        }
+
+        /* Empty expressions */
+        if (v->count == 0) { return v; }
+
+        /* Single expression */
+        if (v->count == 1) { return lval_take(v, 0); }
+
+        /* Ensure first element is a function */
+        lval* f = lval_pop(v, 0);
+        if (f->type != LVAL_FUN) {
+            lval* err = lval_err(LERR_NOT_FUN,
+                "S-Expression starts with incorrect type. Got %s, expected %s",
+                ltype_name(f->type), ltype_name(LVAL_FUN)
+                );
+            lval_del(f);
+            lval_del(v);
+            return err;
+        }
+
+        /* (if c {t} {e}) continues with the chosen branch in place of
+        *  calling the builtin, never copying the other. The branches
+        *  may also be computed rather than literal */
+        if (f->builtin == builtin_if && v->count == 3 && v->cell[0]->type == LVAL_NUM
+            && v->cell[1]->type == LVAL_QEXPR && v->cell[2]->type == LVAL_QEXPR) {
+            lval* x = lval_own(lval_pop(v, v->cell[0]->num ? 1 : 2));
+            x->type = LVAL_SEXPR;
+            lval_del(f);
+            lval_del(v);
+            v = x;
+            continue;
+        }
+
+        /* Leave lambdas in tail position to the caller */
+        if (tf && !f->builtin) {
+            *tf = f;
+            *ta = v;
+            return NULL;
+        }
+
+        /* Call function */
+        return lval_call(e, f, v);
+    }
+}
+
+#if LJIT_ENABLE
+static lval* ljit_call(lval* f, lval* a);
+#endif
+
+/* Call a function, consuming both the function and its arguments */
+lval* lval_call(lenv* e, lval* f, lval* a) {
+    /* If Builtin then simply apply that */
+    if (f->builtin) {
+        lval* result = f->builtin(e, a);
+        lval_del(f);
+        return result;
+    }
+
+    /* Memoised functions look in their cache first */
+    if (LFUN_MEMO(f)) { return lmemo_call(e, f, a); }
+
+    lval* result;
+#if LJIT_ENABLE
+    /* Hot numeric lambdas may run as native code instead */
+    if ((result = ljit_call(f, a))) {
+        lval_del(f);
+        return result;
+    }
+#endif
+
+    lenv* frame = lval_bind(e, f, a, &result);
+    if (!frame) {
+        lval_del(f);
+        return result;
+    }
+
+    /* Evaluate in the frame. Compiled bodies run on the VM, others on the
+    *  tree evaluator. A lambda call in tail position comes back here and
+    *  is made in this loop, so tail recursion runs in constant C stack */
+    for (;;) {
+        lval* tf;
+        lval* ta;
+        if (f->code) {
+            result = lvm_run(frame, f->code, &tf, &ta);
+        } else {
+            lval* x = lval_copy(f->body);
+            x->type = LVAL_SEXPR;
+            result = lval_eval_tail(frame, x, &tf, &ta);
+        }
+        lval_del(f);
+        if (result) { break; }
+
+        f = tf;
+        if (LFUN_MEMO(f)) {
+            result = lmemo_call(frame, f, ta);
+            break;
+        }
+#if LJIT_ENABLE
+        if ((result = ljit_call(f, ta))) {
+            lval_del(f);
+            break;
+        }
+#endif
+        lenv* next = lval_bind(frame, f, ta, &result);
+        if (!next) {
+            lval_del(f);
+            break;
+        }
+
+        /* Scoping is dynamic so the callee may still look up the caller's
+        *  bindings. It takes over those it doesn't shadow and the caller's
+        *  frame is released, so any chain of tail calls holds one frame */
+        for (int i = 0; i < frame->count; i++) {
+            if (lenv_find(next, frame->syms[i]) == -1) {
+                lenv_set(next, frame->syms[i], frame->vals[i]);
+            }
+        }
+        next->par = frame->par;
+        lenv_del(frame);
+        frame = next;
+    }
+
+    lenv_del(frame);
+    return result;
+}
+
+/* Check whether calling `f` with `given` arguments only partially
+*  applies it, being too few to reach its last formal or a '&' */
+int lval_partial(lval* f, int given) {
+    if (f->builtin || LFUN_MEMO(f)) { return 0; }
+    lval* base = f->base ? f->base : f;
+    int bound = f->base ? f->args->count : 0;
+    lval* formals = base->formals;
+
+    int k = bound;
+    while (k < formals->count && formals->cell[k]->sym != lsym_amp) { k++; }
+    return bound + given < k;
+}
+
+/* Bind arguments to a lambda, consuming them. Returns the activation
+*  frame if every formal is bound, or NULL with the partial application
+*  or error in `r` */
+lenv* lval_bind(lenv* e, lval* f, lval* a, lval** r) {
+    /* A partial application binds the arguments it holds to the formals
+    *  of its base function, then the new ones to the formals after */
+    lval* base = f->base ? f->base : f;
+    int bound = f->base ? f->args->count : 0;
+
+    /* Record Argument Counts */
+    lval* formals = base->formals;
+    int given = a->count;
+    int total = formals->count;
+
+    /* Too few arguments give a partial application, which just holds
+    *  them until the rest arrive */
+    if (lval_partial(f, given)) {
+      lval* args = f->base ? lval_copy(f->args) : lval_qexpr();
+      for (int j = 0; j < a->count; j++) { args = lval_add(args, lval_ref(a->cell[j])); }
+      lval_del(a);
+
+      /* Keep the formals still to be bound for printing */
+      lval* rest = lval_copy(formals);
+      for (int j = 0; j < args->count; j++) { lval_del(lval_pop(rest, 0)); }
+
+      lval* p = lval_alloc(LVAL_FUN);
+      p->refs = 1;
+      p->builtin = NULL;
+      p->formals = rest;
+      p->body = lval_ref(base->body);
+      p->code = base->code ? lval_ref(base->code) : NULL;
+      p->base = lval_ref(base);
+      p->args = args;
+      *r = p;
+      return NULL;
+    }
+
+    /* Bind into a fresh activation frame, built once all arguments are
+    *  here. The function itself is shared and never modified */
+    lenv* frame = lenv_frame();
+    frame->par = e;
+    for (int i = 0; i < bound; i++) { lenv_put(frame, formals->cell[i], f->args->cell[i]); }
+
+    /* While arguments still remain to be processed */
+    int i = bound;
+    for (int j = 0; j < a->count; j++) {
+
+    /* If we've ran out of formal arguments to bind */
+    if (i == total) {
+      lval_del(a);
+      lenv_del(frame);
+      *r = lval_err(LERR_ARGS, "Function passed too many arguments. Got %i, Expected %i.", given, total - bound); 
+      return NULL;
+    }
+
+    /* Take the next symbol from the formals */
+    lval* sym = formals->cell[i++];
+
+    /* Special Case to deal with '&' */
+    if (sym->sym == lsym_amp) {
+      
+      /* Ensure '&' is followed by another symbol */
+      if (i != total - 1) {
+        lval_del(a);
+        lenv_del(frame);
+        *r = lval_err(LERR_FORMAT, "Function format invalid. Symbol '&' not followed by single symbol.");
+        return NULL;
+      }
+      
+      /* Next formal should be bound to remaining arguments */
+      lval* rest = lval_qexpr();
+      for (; j < a->count; j++) { rest = lval_add(rest, lval_ref(a->cell[j])); }
+      lenv_put(frame, formals->cell[i++], rest);
+      lval_del(rest);
+      break;
+    }
+
+    /* Bind the next argument into the frame */
+    lenv_put(frame, sym, a->cell[j]);
+    }
+
+    /* Argument list is now bound so can be cleaned up */
+    lval_del(a);
+
+    /* If '&' remains in formal list it should be bound to empty list */
+    if (i < total && formals->cell[i]->sym == lsym_amp) {
+
+    /* Check to ensure that & is not passed invalidly. */
+    if (i != total - 2) {
+      lenv_del(frame);
+      *r = lval_err(LERR_FORMAT, "Function format invalid. Symbol '&' not followed by single symbol.");
+      return NULL;
+    }
+
+    /* Bind the symbol after '&' to an empty list */
+    lval* val = lval_qexpr();
+    lenv_put(frame, formals->cell[i+1], val);
+    lval_del(val);
+    }
+
+    /* Every formal is now bound */
+    return frame;
+}
+
+/* Compiler state while building an LVAL_CODE */
+typedef struct {
+    lins* ins;
+    int count;
+    int size;
+    int depth;
+    int max;
+    lval* consts;
+} lcomp;
+
+/* Append an instruction, keeping `v` alive in the constant pool, and
+*  track the stack depth it leaves behind. Returns its index */
+static int lcomp_emit(lcomp* c, int op, int a, lval* v, int effect) {
+    if (c->count == c->size) {
+        c->size = c->size ? c->size * 2 : 16;
+        c->ins = realloc(c->ins, sizeof(lins) * c->size);
+    }
+    c->ins[c->count].op = op;
+    c->ins[c->count].a = a;
+    c->ins[c->count].v = v;
+    c->ins[c->count].cache = NULL;
+    c->ins[c->count].epoch = 0;
+    if (v) { c->consts = lval_add(c->consts, lval_ref(v)); }
+    c->depth += effect;
+    if (c->depth > c->max) { c->max = c->depth; }
+    return c->count++;
+}
+
+static void lcomp_form(lcomp* c, lval* form, int tail);
+static void lcomp_apply(lcomp* c, lval* form, int tail);
+
+/* Check whether a builtin always gives the same result for the same
+*  arguments and has no other effect */
+static int lcomp_pure(lbuiltin f) {
+    return lnum_opcode(f) != -1 || f == builtin_list || f == builtin_head
+        || f == builtin_tail || f == builtin_join;
+}
+
+/* Evaluate `form` now if it applies a pure global builtin to constants,
+*  recording each builtin symbol and function it relied on in `guards`.
+*  Returns NULL if it can't be folded */
+static lval* lcomp_fold(lval* form, lval* guards) {
+    if (form->count < 2 || !lgc_root) { return NULL; }
+
+    lval* h = form->cell[0];
+    if (h->type != LVAL_SYM || LSYM(h->sym)->locals != 0) { return NULL; }
+    int i = lenv_find(lgc_root, h->sym);
+    if (i == -1) { return NULL; }
+    lval* f = lgc_root->vals[i];
+    if (f->type != LVAL_FUN || !f->builtin || !lcomp_pure(f->builtin)) { return NULL; }
+
+    /* Arguments must be literals or foldable themselves */
+    lval* a = lval_sexpr();
+    for (int j = 1; j < form->count; j++) {
+        lval* x = form->cell[j];
+        switch (x->type) {
+          case LVAL_NUM: case LVAL_STR: case LVAL_QEXPR: x = lval_ref(x); break;
+          case LVAL_SEXPR: x = lcomp_fold(x, guards); break;
+          default: x = NULL; break;
+        }
+        if (!x) {
+            lval_del(a);
+            return NULL;
+        }
+        a = lval_add(a, x);
+    }
+
+    /* Errors are left to be raised when the code runs */
+    lval* r = f->builtin(lgc_root, a);
+    if (r->type == LVAL_ERR) {
+        lval_del(r);
+        return NULL;
+    }
+    guards = lval_add(guards, lval_ref(h));
+    guards = lval_add(guards, lval_ref(f));
+    return r;
+}
+
+/* Compile a call of the top `n` values, returning its result in tail
+*  position */
+static void lcomp_call(lcomp* c, int n, int tail) {
+    if (tail) {
+        lcomp_emit(c, LOP_TAIL, n, NULL, -n);
+    } else {
+        lcomp_emit(c, LOP_CALL, n, NULL, 1 - n);
+    }
+}
+
+/* Compile code leaving the value of one element of an S-Expression */
+static void lcomp_expr(lcomp* c, lval* x) {
+    switch (x->type) {
+      case LVAL_SYM:   lcomp_emit(c, LOP_LOAD, 0, x, 1); break;
+      case LVAL_SEXPR: lcomp_form(c, x, 0); break;
+      /* Everything else evaluates to itself */
+      default:         lcomp_emit(c, LOP_CONST, 0, x, 1); break;
+    }
+}
+
+/* Compile code leaving the value of evaluating the elements of `form`
+*  as an S-Expression, whether it is tagged as one or is a Q-Expression
+*  body about to be evaluated. In tail position the code returns the
+*  value instead, and hands lambda calls back to lval_call */
+static void lcomp_form(lcomp* c, lval* form, int tail) {
+    /* Pure builtins applied to constants are computed now. The result
+    *  is used while the builtins' names still resolve to them, else the
+    *  call is made as normal. Only compiled code folds; the tree
+    *  evaluator always makes the call */
+    lval* guards = lval_add(lval_qexpr(), lval_ref(form));
+    lval* k = lcomp_fold(form, guards);
+    if (k) {
+        int fold = lcomp_emit(c, LOP_FOLD, 0, k, 0);
+        lval_del(k);
+        c->ins[fold].cache = guards;
+        c->ins[fold].epoch = lenv_epoch;
+        c->consts = lval_add(c->consts, guards);
+        lcomp_apply(c, form, tail);
+        c->ins[fold].a = c->count;
+
+        /* In tail position the fallback returns by itself, so the
+        *  folded value jumps past it to be returned */
+        if (tail) {
+            c->depth += 1;
+            lcomp_call(c, 1, 1);
+        }
+        return;
+    }
+    lval_del(guards);
+
+    lcomp_apply(c, form, tail);
 }
 
-/* Pops an element at index i from an s-expr, moving the later elements up */
-lval* lval_pop(lval* v, int i) {
-    /* Find the item at `i` */
-    lval* x = v->cell[i];
-
-    /* Shift the memory following the item at `i` over top it */
-    memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));
+/* Compile the evaluation of `form` without trying to fold it */
+static void lcomp_apply(lcomp* c, lval* form, int tail) {
+    /* (if c {t} {e}) with literal branches evaluates just one of them
+    *  when `if` is still the builtin, falling back to a normal call */
+    if (form->count == 4 && form->cell[0]->type == LVAL_SYM && form->cell[0]->sym == lsym_if
+        && form->cell[2]->type == LVAL_QEXPR && form->cell[3]->type == LVAL_QEXPR) {
+        lcomp_expr(c, form->cell[0]);
+        lcomp_expr(c, form->cell[1]);
+        int branch = lcomp_emit(c, LOP_IF, 0, NULL, -2);
+        lcomp_form(c, form->cell[2], tail);
+        int then = tail ? -1 : lcomp_emit(c, LOP_JUMP, 0, NULL, -1);
+        c->ins[branch].a = c->count;
+        lcomp_form(c, form->cell[3], tail);
+        int other = tail ? -1 : lcomp_emit(c, LOP_JUMP, 0, NULL, -1);
+
+        /* Generic call, with the head and condition still on the stack */
+        c->ins[branch].b = c->count;
+        c->depth += 2;
+        lcomp_emit(c, LOP_CONST, 0, form->cell[2], 1);
+        lcomp_emit(c, LOP_CONST, 0, form->cell[3], 1);
+        lcomp_call(c, 4, tail);
+
+        if (!tail) {
+            c->ins[then].a = c->count;
+            c->ins[other].a = c->count;
+        }
+        return;
+    }
 
-    /* Decrease count of items */
-    v->count--;
+    /* A single element is the value, so a form there is in tail position too */
+    if (form->count == 1 && form->cell[0]->type == LVAL_SEXPR) {
+        lcomp_form(c, form->cell[0], tail);
+        return;
+    }
 
-    /* Reallocate memory used */
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    return x;
+    for (int i = 0; i < form->count; i++) { lcomp_expr(c, form->cell[i]); }
+    lcomp_call(c, form->count, tail);
 }
 
-/* Pops an element at index i from an s-expr, then deletes the s-expr */
-lval* lval_take(lval* v, int i) {
-    lval* x = lval_pop(v, i);
-    lval_del(v);
-    return x;
+/* Compile a lambda body into code for lvm_run */
+lval* lval_compile(lval* body) {
+    lcomp c = { NULL, 0, 0, 0, 0, lval_qexpr() };
+    lcomp_form(&c, body, 1);
+
+    lval* v = lval_alloc(LVAL_CODE);
+    v->refs = 1;
+    v->ins = c.ins;
+    v->ins_count = c.count;
+    v->stack = c.max;
+    v->consts = c.consts;
+    v->jit = NULL;
+    v->calls = 0;
+    return v;
 }
 
-/* Evaluate an lval */
-lval* lval_eval(lenv* e, lval* v) {
-    /* Get symbols from the environment */
-    if (v->type == LVAL_SYM)   { return lenv_get(e, v); }
-    /* Eval s-exprs */
-    if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
-    /* Other types stay the same, so just give them back */
-    return v;
+/* Check a folded constant is still valid, which holds while none of the
+*  symbols it was folded through are bound locally and each still has
+*  the same global binding */
+static int lvm_guard(lins* ip) {
+    lval* g = ip->cache;
+    for (int i = 1; i < g->count; i += 2) {
+        if (LSYM(g->cell[i]->sym)->locals != 0) { return 0; }
+    }
+    if (ip->epoch == lenv_epoch) { return 1; }
+
+    for (int i = 1; i < g->count; i += 2) {
+        int j = lenv_find(lgc_root, g->cell[i]->sym);
+        if (j == -1 || lgc_root->vals[j] != g->cell[i+1]) { return 0; }
+    }
+    ip->epoch = lenv_epoch;
+    return 1;
 }
 
-/* Evaluate an s-expr */
-lval* lval_eval_sexpr(lenv* e, lval* v) {
-    /* Evaluate children */
-    for (int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
+/* Names of the VM opcodes */
+static char* lop_names[] = { "const", "load", "call", "if", "jump", "tail", "fold" };
+
+/* Print compiled code one instruction per line */
+void lvm_print(lval* code) {
+    for (int i = 0; i < code->ins_count; i++) {
+        lins* ip = &code->ins[i];
+        printf("%4i  %-5s ", i, lop_names[ip->op]);
+        switch (ip->op) {
+          case LOP_CONST:
+          case LOP_LOAD: lval_print(ip->v); break;
+          case LOP_CALL:
+          case LOP_TAIL:
+          case LOP_JUMP: printf("%i", ip->a); break;
+          case LOP_IF:   printf("else %i, call %i", ip->a, ip->b); break;
+          case LOP_FOLD:
+            lval_print(ip->v);
+            printf(" = ");
+            lval_expr_print(ip->cache->cell[0], '(', ')');
+            printf(", then %i", ip->a);
+          break;
+        }
+        putchar('\n');
     }
+}
 
+/* Apply the evaluated elements of an S-Expression as lval_eval_tail
+*  would, consuming them */
+lval* lvm_apply(lenv* e, lval** vals, int n, lval** tf, lval** ta) {
     /* Error checking */
-    for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+    for (int i = 0; i < n; i++) {
+        if (vals[i]->type == LVAL_ERR) {
+            lval* err = vals[i];
+            for (int j = 0; j < n; j++) { if (j != i) { lval_del(vals[j]); } }
+            return err;
+        }
     }
 
-    /* Empty expressions */
-    if (v->count == 0) { return v; }
-
-    /* Single expression */
-    if (v->count == 1) { return lval_take(v, 0); }
+    /* Empty and single expressions */
+    if (n == 0) { return lval_sexpr(); }
+    if (n == 1) { return vals[0]; }
 
     /* Ensure first element is a function */
-    lval* f = lval_pop(v, 0);
-    if (f->type != LVAL_FUN) {
-        lval* err = lval_err(
+    if (vals[0]->type != LVAL_FUN) {
+        lval* err = lval_err(LERR_NOT_FUN,
             "S-Expression starts with incorrect type. Got %s, expected %s",
-            ltype_name(f->type), ltype_name(LVAL_FUN)
+            ltype_name(vals[0]->type), ltype_name(LVAL_FUN)
             );
-        lval_del(f);
-        lval_del(v);
+        for (int i = 0; i < n; i++) { lval_del(vals[i]); }
         return err;
     }
 
-    /* Call function */
-    lval* result = lval_call(e, f, v);
-    lval_del(f);
-    return result;
+    /* Combine two numbers with a numeric builtin without an argument list */
+    if (n == 3 && vals[0]->builtin && vals[1]->type == LVAL_NUM && vals[2]->type == LVAL_NUM) {
+        int op = lnum_opcode(vals[0]->builtin);
+        if (op != -1) {
+            lval* x = lnum_apply(op, vals[1]->num, vals[2]->num);
+            for (int i = 0; i < n; i++) { lval_del(vals[i]); }
+            return x;
+        }
+    }
+
+    /* Call function, or leave it to the caller in tail position */
+    lval* a = lval_sexpr();
+    for (int i = 1; i < n; i++) { a = lval_add(a, vals[i]); }
+    if (tf && !vals[0]->builtin) {
+        *tf = vals[0];
+        *ta = a;
+        return NULL;
+    }
+    return lval_call(e, vals[0], a);
 }
 
-/* Call a function */
-lval* lval_call(lenv* e, lval* f, lval* a) {
-    /* If Builtin then simply apply that */
-    if (f->builtin) { return f->builtin(e, a); }
+/* Run compiled code in an environment. A lambda call the code ends in
+*  is handed back through `tf` and `ta`, returning NULL */
+lval* lvm_run(lenv* e, lval* code, lval** tf, lval** ta) {
+    lval* stack[code->stack + 1];
+    lval** sp = stack;
+    lins* ip = code->ins;
+
+#if LVM_COMPUTED_GOTO
+    static void* labels[] = { &&op_CONST, &&op_LOAD, &&op_CALL, &&op_IF, &&op_JUMP, &&op_TAIL, &&op_FOLD };
+    #define LVM_CASE(op) op_##op:
+    #define LVM_NEXT() goto *labels[ip->op]
+#else
+    #define LVM_CASE(op) case LOP_##op:
+    #define LVM_NEXT() continue
+#endif
+
+#if !LVM_COMPUTED_GOTO
+    for (;;) switch (ip->op) {
+#else
+    LVM_NEXT();
+#endif
+        LVM_CASE(CONST)
+            *sp++ = lval_ref(ip->v);
+            ip++;
+            LVM_NEXT();
+
+        LVM_CASE(LOAD)
+            /* Symbols bound only globally hit the cache until a global
+            *  is defined or redefined */
+            if (LSYM(ip->v->sym)->locals == 0) {
+                if (ip->epoch != lenv_epoch) {
+                    lval* x = lenv_get(e, ip->v);
+                    if (x->type == LVAL_ERR) {
+                        *sp++ = x;
+                        ip++;
+                        LVM_NEXT();
+                    }
+                    lval_del(x);
+                    ip->cache = x;
+                    ip->epoch = lenv_epoch;
+                }
+                *sp++ = lval_ref(ip->cache);
+            } else {
+                *sp++ = lenv_get(e, ip->v);
+            }
+            ip++;
+            LVM_NEXT();
+
+        LVM_CASE(CALL)
+            sp -= ip->a;
+            *sp = lvm_apply(e, sp, ip->a, NULL, NULL);
+            sp++;
+            ip++;
+            LVM_NEXT();
+
+        LVM_CASE(IF)
+            /* Only branch directly on the real `if` and a number */
+            if (sp[-2]->type == LVAL_FUN && sp[-2]->builtin == builtin_if
+                && sp[-1]->type == LVAL_NUM) {
+                long cond = sp[-1]->num;
+                lval_del(*--sp);
+                lval_del(*--sp);
+                ip = cond ? ip + 1 : code->ins + ip->a;
+            } else {
+                ip = code->ins + ip->b;
+            }
+            LVM_NEXT();
 
-    /* Record Argument Counts */
-    int given = a->count;
-    int total = f->formals->count;
+        LVM_CASE(JUMP)
+            ip = code->ins + ip->a;
+            LVM_NEXT();
 
-    /* While arguments still remain to be processed */
-    while (a->count) {
+        LVM_CASE(FOLD)
+            if (lvm_guard(ip)) {
+                *sp++ = lval_ref(ip->v);
+                ip = code->ins + ip->a;
+            } else {
+                ip++;
+            }
+            LVM_NEXT();
 
-    /* If we've ran out of formal arguments to bind */
-    if (f->formals->count == 0) {
-      lval_del(a);
-      return lval_err("Function passed too many arguments. Got %i, Expected %i.", given, total); 
+        LVM_CASE(TAIL)
+            sp -= ip->a;
+            return lvm_apply(e, sp, ip->a, tf, ta);
+
+#if !LVM_COMPUTED_GOTO
     }
+#endif
 
-    /* Pop the first symbol from the formals */
-    lval* sym = lval_pop(f->formals, 0);
+    #undef LVM_CASE
+    #undef LVM_NEXT
+}
 
-    /* Special Case to deal with '&' */
-    if (strcmp(sym->sym, "&") == 0) {
-      
-      /* Ensure '&' is followed by another symbol */
-      if (f->formals->count != 1) {
-        lval_del(a);
-        return lval_err("Function format invalid. Symbol '&' not followed by single symbol.");
+#if LJIT_ENABLE
+
+/* Machine code being generated for a lambda. Offsets are into `buf`,
+*  which is copied as a whole to executable memory once complete */
+typedef struct {
+    unsigned char* buf;
+    int len;
+    int size;
+    lval* f;
+    int bail;
+    int entry;
+    int start;
+    int ndeps;
+    ljit_dep* deps;
+} ljc;
+
+/* Registers arguments are passed in, by number: rdi rsi rdx rcx r8 r9 */
+static int ljit_arg_regs[] = { 7, 6, 2, 1, 8, 9 };
+
+/* Append `n` bytes */
+static void ljit_emit(ljc* c, int n, ...) {
+    if (c->len + n > c->size) {
+        c->size = c->size * 2 + n;
+        c->buf = realloc(c->buf, c->size);
+    }
+    va_list va;
+    va_start(va, n);
+    for (int i = 0; i < n; i++) { c->buf[c->len++] = va_arg(va, int); }
+    va_end(va);
+}
+
+/* Append a 32-bit little-endian value */
+static void ljit_emit32(ljc* c, unsigned int x) {
+    ljit_emit(c, 4, x & 0xFF, (x >> 8) & 0xFF, (x >> 16) & 0xFF, x >> 24);
+}
+
+/* Point the rel32 at `at` to `target` */
+static void ljit_patch(ljc* c, int at, int target) {
+    unsigned int rel = target - (at + 4);
+    for (int i = 0; i < 4; i++) { c->buf[at + i] = (rel >> (8 * i)) & 0xFF; }
+}
+
+/* Append a jump or call opcode with its rel32 to `target`, or a
+*  placeholder to patch if `target` is -1. Returns the rel32 offset */
+static int ljit_jump(ljc* c, int n, int op0, int op1, int target) {
+    if (n == 1) { ljit_emit(c, 1, op0); } else { ljit_emit(c, 2, op0, op1); }
+    int at = c->len;
+    ljit_emit32(c, 0);
+    if (target != -1) { ljit_patch(c, at, target); }
+    return at;
+}
+
+/* Return with the value in rax and a zero status in edx */
+static void ljit_return(ljc* c) {
+    ljit_emit(c, 4, 0x31, 0xD2, 0xC9, 0xC3);
+}
+
+/* Find the slot of a formal, the last one if the name repeats */
+static int ljit_formal(ljc* c, char* sym) {
+    lval* formals = c->f->formals;
+    for (int i = formals->count - 1; i >= 0; i--) {
+        if (formals->cell[i]->sym == sym) { return i; }
+    }
+    return -1;
+}
+
+/* Get the global function a head symbol calls, recording the dependency.
+*  Returns NULL for anything the JIT can't call */
+static lval* ljit_head(ljc* c, lval* h) {
+    if (h->type != LVAL_SYM || ljit_formal(c, h->sym) != -1) { return NULL; }
+    int i = lenv_find(lgc_root, h->sym);
+    if (i == -1) { return NULL; }
+    lval* g = lgc_root->vals[i];
+    if (g->type != LVAL_FUN || g->base) { return NULL; }
+
+    lbuiltin b = g->builtin;
+    if (b) {
+        if (b != builtin_if && lnum_opcode(b) == -1) { return NULL; }
+    } else if (g->code != c->f->code) {
+        return NULL;
+    }
+
+    for (i = 0; i < c->ndeps; i++) {
+        if (c->deps[i].sym == h->sym) { return g; }
+    }
+    c->deps = realloc(c->deps, sizeof(ljit_dep) * (c->ndeps + 1));
+    c->deps[c->ndeps].sym = h->sym;
+    c->deps[c->ndeps].builtin = b;
+    c->ndeps++;
+    return g;
+}
+
+static int ljit_form(ljc* c, lval* form, int tail);
+
+/* Generate code leaving the value of `x` in rax, or returning it in tail
+*  position. Returns 0 if `x` isn't numeric code the JIT handles */
+static int ljit_expr(ljc* c, lval* x, int tail) {
+    switch (x->type) {
+      case LVAL_NUM:
+        /* mov rax, imm64 */
+        ljit_emit(c, 2, 0x48, 0xB8);
+        ljit_emit32(c, (unsigned long)x->num & 0xFFFFFFFF);
+        ljit_emit32(c, (unsigned long)x->num >> 32);
+      break;
+      case LVAL_SYM: {
+        int i = ljit_formal(c, x->sym);
+        if (i == -1) { return 0; }
+        /* mov rax, [rbp - 8(i+1)] */
+        ljit_emit(c, 4, 0x48, 0x8B, 0x45, -8 * (i + 1) & 0xFF);
       }
-      
-      /* Next formal should be bound to remaining arguments */
-      lval* nsym = lval_pop(f->formals, 0);
-      lenv_put(f->env, nsym, builtin_list(e, a));
-      lval_del(sym); lval_del(nsym);
       break;
+      case LVAL_SEXPR: return ljit_form(c, x, tail);
+      default: return 0;
+    }
+    if (tail) { ljit_return(c); }
+    return 1;
+}
+
+/* Generate code for evaluating the elements of `form` */
+static int ljit_form(ljc* c, lval* form, int tail) {
+    if (form->count == 1) { return ljit_expr(c, form->cell[0], tail); }
+    if (form->count == 0) { return 0; }
+
+    lval* g = ljit_head(c, form->cell[0]);
+    if (!g) { return 0; }
+
+    /* (if c {t} {e}) branches on the condition */
+    if (g->builtin == builtin_if) {
+        if (form->count != 4 || form->cell[2]->type != LVAL_QEXPR
+            || form->cell[3]->type != LVAL_QEXPR) { return 0; }
+        if (!ljit_expr(c, form->cell[1], 0)) { return 0; }
+        /* test rax, rax; je else */
+        ljit_emit(c, 3, 0x48, 0x85, 0xC0);
+        int other = ljit_jump(c, 2, 0x0F, 0x84, -1);
+        if (!ljit_form(c, form->cell[2], tail)) { return 0; }
+        int end = tail ? -1 : ljit_jump(c, 1, 0xE9, 0, -1);
+        ljit_patch(c, other, c->len);
+        if (!ljit_form(c, form->cell[3], tail)) { return 0; }
+        if (!tail) { ljit_patch(c, end, c->len); }
+        return 1;
     }
 
-    /* Pop the next argument from the list */
-    lval* val = lval_pop(a, 0);
+    /* Calls to the lambda itself pass the arguments in registers, or
+    *  in tail position overwrite the formals and jump back to the start */
+    if (!g->builtin) {
+        int n = form->count - 1;
+        if (n != c->f->formals->count) { return 0; }
+        for (int i = 1; i <= n; i++) {
+            if (!ljit_expr(c, form->cell[i], 0)) { return 0; }
+            ljit_emit(c, 1, 0x50);
+        }
+        for (int i = n - 1; i >= 0; i--) {
+            if (tail) {
+                /* pop rax; mov [rbp - 8(i+1)], rax */
+                ljit_emit(c, 5, 0x58, 0x48, 0x89, 0x45, -8 * (i + 1) & 0xFF);
+            } else {
+                int r = ljit_arg_regs[i];
+                if (r >= 8) { ljit_emit(c, 1, 0x41); }
+                ljit_emit(c, 1, 0x58 + (r & 7));
+            }
+        }
+        if (tail) {
+            ljit_jump(c, 1, 0xE9, 0, c->start);
+            return 1;
+        }
+        /* call entry; test rdx, rdx; jne bail */
+        ljit_jump(c, 1, 0xE8, 0, c->entry);
+        ljit_emit(c, 3, 0x48, 0x85, 0xD2);
+        ljit_jump(c, 2, 0x0F, 0x85, c->bail);
+        return 1;
+    }
 
-    /* Bind a copy into the function's environment */
-    lenv_put(f->env, sym, val);
+    /* Numeric builtins fold their arguments left to right */
+    int op = lnum_opcode(g->builtin);
+    if (op >= LNUM_GT && form->count != 3) { return 0; }
+    if (!ljit_expr(c, form->cell[1], 0)) { return 0; }
+
+    /* neg rax for unary minus */
+    if (op == LNUM_SUB && form->count == 2) { ljit_emit(c, 3, 0x48, 0xF7, 0xD8); }
+
+    for (int i = 2; i < form->count; i++) {
+        /* push rax; <arg>; mov rcx, rax; pop rax */
+        ljit_emit(c, 1, 0x50);
+        if (!ljit_expr(c, form->cell[i], 0)) { return 0; }
+        ljit_emit(c, 4, 0x48, 0x89, 0xC1, 0x58);
+
+        switch (op) {
+          case LNUM_ADD: ljit_emit(c, 3, 0x48, 0x01, 0xC8); break;
+          case LNUM_SUB: ljit_emit(c, 3, 0x48, 0x29, 0xC8); break;
+          case LNUM_MUL: ljit_emit(c, 4, 0x48, 0x0F, 0xAF, 0xC1); break;
+          case LNUM_DIV:
+            /* Division by zero gives up, and by -1 negates rather than
+            *  trapping on the smallest number */
+            ljit_emit(c, 3, 0x48, 0x85, 0xC9);
+            ljit_jump(c, 2, 0x0F, 0x84, c->bail);
+            ljit_emit(c, 4, 0x48, 0x83, 0xF9, 0xFF);
+            ljit_emit(c, 2, 0x75, 0x05);
+            ljit_emit(c, 3, 0x48, 0xF7, 0xD8);
+            ljit_emit(c, 2, 0xEB, 0x05);
+            ljit_emit(c, 5, 0x48, 0x99, 0x48, 0xF7, 0xF9);
+          break;
+          default: {
+            /* cmp rax, rcx; setcc al; movzx eax, al */
+            static int cc[] = { 0x9F, 0x9C, 0x9D, 0x9E, 0x94, 0x95 };
+            ljit_emit(c, 9, 0x48, 0x39, 0xC8, 0x0F, cc[op - LNUM_GT], 0xC0, 0x0F, 0xB6, 0xC0);
+          }
+          break;
+        }
+    }
+    if (tail) { ljit_return(c); }
+    return 1;
+}
 
-    /* Delete symbol and value */
-    lval_del(sym); lval_del(val);
+/* Compile a lambda to native code, or return NULL if it uses anything
+*  but numbers, its formals, numeric builtins, if and calls to itself */
+ljit* ljit_compile(lval* f) {
+    lval* formals = f->formals;
+    int n = formals->count;
+    if (n == 0 || n > 6 || !lgc_root) { return NULL; }
+    for (int i = 0; i < n; i++) {
+        if (formals->cell[i]->sym == lsym_amp) { return NULL; }
     }
 
-    /* Argument list is now bound so can be cleaned up */
-    lval_del(a);
+    ljc c = { NULL, 0, 0, f, 0, 0, 0, 0, NULL };
 
-    /* If '&' remains in formal list it should be bound to empty list */
-    if (f->formals->count > 0 &&
-    strcmp(f->formals->cell[0]->sym, "&") == 0) {
+    /* C entry point: push rbx; mov rbx, rsi; mov r10, rdi; load the
+    *  arguments; call entry; mov [rbx], edx; pop rbx; ret */
+    ljit_emit(&c, 7, 0x53, 0x48, 0x89, 0xF3, 0x49, 0x89, 0xFA);
+    for (int i = 0; i < n; i++) {
+        int r = ljit_arg_regs[i];
+        ljit_emit(&c, 4, r >= 8 ? 0x4D : 0x49, 0x8B, 0x42 | (r & 7) << 3, 8 * i);
+    }
+    int call = ljit_jump(&c, 1, 0xE8, 0, -1);
+    ljit_emit(&c, 4, 0x89, 0x13, 0x5B, 0xC3);
+
+    /* Giving up: mov edx, 1; leave; ret */
+    c.bail = c.len;
+    ljit_emit(&c, 7, 0xBA, 0x01, 0x00, 0x00, 0x00, 0xC9, 0xC3);
+
+    /* Entry: push rbp; mov rbp, rsp; sub rsp, 8n; spill the arguments */
+    c.entry = c.len;
+    ljit_patch(&c, call, c.entry);
+    ljit_emit(&c, 8, 0x55, 0x48, 0x89, 0xE5, 0x48, 0x83, 0xEC, 8 * n);
+    for (int i = 0; i < n; i++) {
+        int r = ljit_arg_regs[i];
+        ljit_emit(&c, 4, r >= 8 ? 0x4C : 0x48, 0x89, 0x45 | (r & 7) << 3, -8 * (i + 1) & 0xFF);
+    }
+    c.start = c.len;
 
-    /* Check to ensure that & is not passed invalidly. */
-    if (f->formals->count != 2) {
-      return lval_err("Function format invalid. Symbol '&' not followed by single symbol.");
+    if (!ljit_form(&c, f->body, 1)) {
+        free(c.buf);
+        free(c.deps);
+        return NULL;
+    }
+
+    /* Copy into executable memory */
+    void* mem = mmap(NULL, c.len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        free(c.buf);
+        free(c.deps);
+        return NULL;
+    }
+    memcpy(mem, c.buf, c.len);
+    free(c.buf);
+
+    /* Systems that refuse executable mappings keep the interpreter */
+    if (mprotect(mem, c.len, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, c.len);
+        free(c.deps);
+        return NULL;
     }
 
-    /* Pop and delete '&' symbol */
-    lval_del(lval_pop(f->formals, 0));
+    ljit* j = malloc(sizeof(ljit));
+    j->mem = mem;
+    j->size = c.len;
+    j->entry = (long (*)(long*, int*))mem;
+    j->nargs = n;
+    j->epoch = lenv_epoch;
+    j->ndeps = c.ndeps;
+    j->deps = c.deps;
+    return j;
+}
 
-    /* Pop next symbol and create empty list */
-    lval* sym = lval_pop(f->formals, 0);
-    lval* val = lval_qexpr();
+/* Release native code */
+void ljit_free(ljit* j) {
+    munmap(j->mem, j->size);
+    free(j->deps);
+    free(j);
+}
 
-    /* Bind to environment and delete */
-    lenv_put(f->env, sym, val);
-    lval_del(sym); lval_del(val);
+/* Check the globals native code relies on. Returns 1 if they are as
+*  compiled against, 0 if one is shadowed by a local binding for now,
+*  or -1 if one has been redefined */
+static int ljit_valid(lval* code) {
+    ljit* j = code->jit;
+    for (int i = 0; i < j->ndeps; i++) {
+        if (LSYM(j->deps[i].sym)->locals != 0) { return 0; }
     }
+    if (j->epoch == lenv_epoch) { return 1; }
+
+    for (int i = 0; i < j->ndeps; i++) {
+        int k = lenv_find(lgc_root, j->deps[i].sym);
+        if (k == -1) { return -1; }
+        lval* g = lgc_root->vals[k];
+        if (g->type != LVAL_FUN || g->builtin != j->deps[i].builtin) { return -1; }
+        if (!g->builtin && (g->base || g->code != code)) { return -1; }
+    }
+    j->epoch = lenv_epoch;
+    return 1;
+}
 
-    /* If all formals have been bound evaluate */
-    if (f->formals->count == 0) {
+/* Make a call to a lambda as native code, compiling it once it is hot.
+*  Returns NULL, leaving `a` untouched, for the caller to make the call
+*  itself whenever that can't be done */
+static lval* ljit_call(lval* f, lval* a) {
+    lval* code = f->code;
+    if (!code || f->base) { return NULL; }
+
+    if (!code->jit) {
+        if (code->calls < 0 || ++code->calls < LJIT_THRESHOLD) { return NULL; }
+        code->jit = ljit_compile(f);
+        if (!code->jit) {
+            code->calls = -1;
+            return NULL;
+        }
+        if (lvm_dump) {
+            lval_print(f);
+            printf(" compiled to %zu bytes of native code\n", code->jit->size);
+        }
+    }
 
-    /* Set Function Environment parent to current evaluation Environment */
-    f->env->par = e;
+    ljit* j = code->jit;
+    if (a->count != j->nargs) { return NULL; }
+    long args[6];
+    for (int i = 0; i < a->count; i++) {
+        if (a->cell[i]->type != LVAL_NUM) { return NULL; }
+        args[i] = a->cell[i]->num;
+    }
 
-    /* Evaluate and return */
-    return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-    } else {
-    /* Otherwise return partially evaluated function */
-    return lval_copy(f);
+    /* Deoptimise if a global the code relies on was redefined, dropping
+    *  it and counting calls afresh */
+    int valid = ljit_valid(code);
+    if (valid == -1) {
+        ljit_free(j);
+        code->jit = NULL;
+        code->calls = 0;
+        return NULL;
     }
+    if (valid == 0) { return NULL; }
+
+    /* Errors such as division by zero are left to the interpreter, which
+    *  can simply run the call again as the code has no effects */
+    int status;
+    long r = j->entry(args, &status);
+    if (status) { return NULL; }
+    lval_del(a);
+    return lval_num(r);
 }
 
+#endif
+
 /* See if two lvals are equal to each other by checking fields */
 int lval_eq(lval* x, lval* y) {
     /* Diff types are unequal */
@@ -571,14 +2495,20 @@ int lval_eq(lval* x, lval* y) {
         case LVAL_NUM: return (x->num == y->num);
 
         /* Compare strings */
-        case LVAL_ERR: return (strcmp(x->err, y->err) == 0);
-        case LVAL_SYM: return (strcmp(x->sym, y->sym) == 0);
+        case LVAL_ERR: return (strcmp(lval_err_msg(x), lval_err_msg(y)) == 0);
+        case LVAL_SYM: return (x->sym == y->sym);
         case LVAL_STR: return (strcmp(x->str, y->str) == 0);
 
-        /* If builtin compare functions, otherwise formals and body */
+        /* If builtin compare functions, if memoised what they memoise,
+        *  if partially applied the base lambda and the arguments bound
+        *  so far, otherwise formals and body */
         case LVAL_FUN:
-            if (x->builtin) {
+            if (x->builtin || y->builtin) {
                 return x->builtin == y->builtin;
+            } else if (LFUN_MEMO(x) || LFUN_MEMO(y)) {
+                return LFUN_MEMO(x) && LFUN_MEMO(y) && lval_eq(x->base, y->base);
+            } else if (x->base || y->base) {
+                return x->base && y->base && lval_eq(x->base, y->base) && lval_eq(x->args, y->args);
             } else {
                 return lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body);
             }
@@ -598,53 +2528,229 @@ int lval_eq(lval* x, lval* y) {
     return 0;
 }
 
+/* Hash an lval by its contents, so that values lval_eq finds equal
+*  hash the same */
+unsigned long lval_hash(lval* v) {
+    unsigned long h = (v->type + 1) * 2654435761UL;
+    switch (v->type) {
+      case LVAL_NUM: h ^= (unsigned long)v->num; break;
+      case LVAL_ERR: h ^= lsym_hash(lval_err_msg(v)); break;
+      case LVAL_SYM: h ^= lenv_hash(v->sym); break;
+      case LVAL_STR: h ^= lsym_hash(v->str); break;
+      case LVAL_FUN:
+        if (v->builtin) {
+          h ^= (unsigned long)v->builtin;
+        } else if (LFUN_MEMO(v)) {
+          h ^= lval_hash(v->base) * 31;
+        } else if (v->base) {
+          h ^= lval_hash(v->base) * 31 + lval_hash(v->args);
+        } else {
+          h ^= lval_hash(v->formals) * 31 + lval_hash(v->body);
+        }
+      break;
+      case LVAL_QEXPR:
+      case LVAL_SEXPR:
+        for (int i = 0; i < v->count; i++) {
+          h = (h ^ lval_hash(v->cell[i])) * 1099511628211UL;
+        }
+      break;
+    }
+
+    /* Mix the bits so that nearby numbers spread over the buckets */
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9UL;
+    h ^= h >> 29;
+    return h;
+}
+
+/* Find the entry caching the result for the arguments `a`, or -1 */
+static int lmemo_find(lmemo* m, lval* a, unsigned long h) {
+    if (!m->nbuckets) { return -1; }
+    for (int i = m->buckets[h & (m->nbuckets - 1)]; i != -1; i = m->entries[i].chain) {
+        if (m->entries[i].hash == h && lval_eq(m->entries[i].key, a)) { return i; }
+    }
+    return -1;
+}
+
+/* Take an entry out of the recently used list */
+static void lmemo_unlink(lmemo* m, int i) {
+    lmemo_entry* x = &m->entries[i];
+    if (x->prev != -1) { m->entries[x->prev].next = x->next; } else { m->first = x->next; }
+    if (x->next != -1) { m->entries[x->next].prev = x->prev; } else { m->last = x->prev; }
+}
+
+/* Put an entry at the front of the recently used list */
+static void lmemo_push(lmemo* m, int i) {
+    m->entries[i].prev = -1;
+    m->entries[i].next = m->first;
+    if (m->first != -1) { m->entries[m->first].prev = i; } else { m->last = i; }
+    m->first = i;
+}
+
+/* Chain an entry into its hash bucket */
+static void lmemo_chain(lmemo* m, int i) {
+    int* b = &m->buckets[m->entries[i].hash & (m->nbuckets - 1)];
+    m->entries[i].chain = *b;
+    *b = i;
+}
+
+/* Cache `val` for the arguments `key`, consuming both. Once full, the
+*  least recently used entry makes way */
+static void lmemo_insert(lmemo* m, lval* key, lval* val, unsigned long h) {
+    int i;
+    if (m->count < m->max) {
+        /* Grow the entries, rebuilding the buckets to match */
+        if (m->count == m->size) {
+            m->size = m->size ? m->size * 2 : 16;
+            if (m->size > m->max) { m->size = m->max; }
+            m->entries = realloc(m->entries, sizeof(lmemo_entry) * m->size);
+
+            m->nbuckets = 16;
+            while (m->nbuckets < m->size) { m->nbuckets *= 2; }
+            m->buckets = realloc(m->buckets, sizeof(int) * m->nbuckets);
+            for (int j = 0; j < m->nbuckets; j++) { m->buckets[j] = -1; }
+            for (int j = 0; j < m->count; j++) { lmemo_chain(m, j); }
+        }
+        i = m->count++;
+    } else {
+        /* Evict the least recently used entry, reusing its slot */
+        i = m->last;
+        lmemo_unlink(m, i);
+        int* b = &m->buckets[m->entries[i].hash & (m->nbuckets - 1)];
+        while (*b != i) { b = &m->entries[*b].chain; }
+        *b = m->entries[i].chain;
+        lval_del(m->entries[i].key);
+        lval_del(m->entries[i].val);
+        m->evictions++;
+    }
+
+    m->entries[i].hash = h;
+    m->entries[i].key = key;
+    m->entries[i].val = val;
+    lmemo_chain(m, i);
+    lmemo_push(m, i);
+}
+
+/* Call a memoised function, consuming both it and its arguments. Results
+*  other than errors are cached, so later calls with equal arguments give
+*  them back without calling the function it memoises */
+lval* lmemo_call(lenv* e, lval* f, lval* a) {
+    lmemo* m = f->args->memo;
+
+    /* Too few arguments just give a partial application, which isn't
+    *  worth caching */
+    if (lval_partial(f->base, a->count)) {
+        lval* r = lval_call(e, lval_ref(f->base), a);
+        lval_del(f);
+        return r;
+    }
+
+    unsigned long h = lval_hash(a);
+
+    int i = lmemo_find(m, a, h);
+    if (i != -1) {
+        m->hits++;
+        lmemo_unlink(m, i);
+        lmemo_push(m, i);
+        lval* r = lval_ref(m->entries[i].val);
+        lval_del(f);
+        lval_del(a);
+        return r;
+    }
+    m->misses++;
+
+    /* Keep the arguments as the key, sharing them with the call. The
+    *  call may have cached them itself if it recursed */
+    lval* key = lval_copy(a);
+    lval* r = lval_call(e, lval_ref(f->base), a);
+    if (r->type != LVAL_ERR && lmemo_find(m, key, h) == -1) {
+        lmemo_insert(m, key, lval_ref(r), h);
+    } else {
+        lval_del(key);
+    }
+    lval_del(f);
+    return r;
+}
+
 /* Performs arithmetic operations */
-lval* builtin_op(lenv* e, lval* a, char* op) {
+/* Names of the numeric operators, for error messages */
+static char* lnum_names[] = { "+", "-", "*", "/", ">", "<", ">=", "<=", "==", "!=" };
+
+/* Apply a numeric operator to two numbers */
+lval* lnum_apply(int op, long x, long y) {
+    switch (op) {
+      case LNUM_ADD: return lval_num(x + y);
+      case LNUM_SUB: return lval_num(x - y);
+      case LNUM_MUL: return lval_num(x * y);
+      case LNUM_DIV: return y == 0 ? lval_err(LERR_DIV_ZERO, "Division by zero") : lval_num(x / y);
+      case LNUM_GT:  return lval_num(x >  y);
+      case LNUM_LT:  return lval_num(x <  y);
+      case LNUM_GE:  return lval_num(x >= y);
+      case LNUM_LE:  return lval_num(x <= y);
+      case LNUM_EQ:  return lval_num(x == y);
+      default:       return lval_num(x != y);
+    }
+}
+
+/* Get the operator a numeric builtin applies, or -1 for other functions */
+int lnum_opcode(lbuiltin f) {
+    if (f == builtin_add) { return LNUM_ADD; }
+    if (f == builtin_sub) { return LNUM_SUB; }
+    if (f == builtin_mul) { return LNUM_MUL; }
+    if (f == builtin_div) { return LNUM_DIV; }
+    if (f == builtin_gt)  { return LNUM_GT; }
+    if (f == builtin_lt)  { return LNUM_LT; }
+    if (f == builtin_ge)  { return LNUM_GE; }
+    if (f == builtin_le)  { return LNUM_LE; }
+    if (f == builtin_eq)  { return LNUM_EQ; }
+    if (f == builtin_ne)  { return LNUM_NE; }
+    return -1;
+}
+
+lval* builtin_op(lenv* e, lval* a, int op) {
     /* Ensure all arguments are numbers */
     for (int i = 0; i < a->count; i++) {
-        LASSERT_TYPE(op, a, i, LVAL_NUM);
+        LASSERT_TYPE(lnum_names[op], a, i, LVAL_NUM);
     }
 
-    /* Pop the first element */
-    lval* x = lval_pop(a, 0);
+    /* Two numbers, the common case, are combined directly */
+    if (a->count == 2) {
+        lval* x = lnum_apply(op, a->cell[0]->num, a->cell[1]->num);
+        lval_del(a);
+        return x;
+    }
+
+    /* Otherwise fold the arguments in place into an accumulator */
+    long r = a->cell[0]->num;
 
     /* If no arguments and sub then perform unary negation */
-    if ((strcmp(op, "-") == 0) && a->count == 0) { x->num = -x->num; }
-
-    /* While there are still elements remaining */
-    while (a->count > 0) {
-        /* Pop next element */
-        lval* y = lval_pop(a, 0);
-
-        /* Perform operation */
-        if (strcmp(op, "+") == 0) { x->num += y->num; }
-        if (strcmp(op, "-") == 0) { x->num -= y->num; }
-        if (strcmp(op, "*") == 0) { x->num *= y->num; }
-        if (strcmp(op, "/") == 0) {
-            if (y->num == 0) {
-                lval_del(x);
-                lval_del(y);
+    if (op == LNUM_SUB && a->count == 1) { r = -r; }
+
+    for (int i = 1; i < a->count; i++) {
+        long y = a->cell[i]->num;
+        switch (op) {
+          case LNUM_ADD: r += y; break;
+          case LNUM_SUB: r -= y; break;
+          case LNUM_MUL: r *= y; break;
+          case LNUM_DIV:
+            if (y == 0) {
                 lval_del(a);
-                x = lval_err("Division by zero");
-                break;
-            } else {
-                x->num /= y->num;
+                return lval_err(LERR_DIV_ZERO, "Division by zero");
             }
+            r /= y;
+          break;
         }
-
-        /* Delete the element now finished with */
-        lval_del(y);
     }
 
     /* Delete input expression and return result */
     lval_del(a);
-    return x;
+    return lval_num(r);
 }
 
-lval* builtin_add(lenv* e, lval* a) { return builtin_op(e, a, "+"); }
-lval* builtin_sub(lenv* e, lval* a) { return builtin_op(e, a, "-"); }
-lval* builtin_mul(lenv* e, lval* a) { return builtin_op(e, a, "*"); }
-lval* builtin_div(lenv* e, lval* a) { return builtin_op(e, a, "/"); }
+lval* builtin_add(lenv* e, lval* a) { return builtin_op(e, a, LNUM_ADD); }
+lval* builtin_sub(lenv* e, lval* a) { return builtin_op(e, a, LNUM_SUB); }
+lval* builtin_mul(lenv* e, lval* a) { return builtin_op(e, a, LNUM_MUL); }
+lval* builtin_div(lenv* e, lval* a) { return builtin_op(e, a, LNUM_DIV); }
 
 /* Builtin function for `head` */
 lval* builtin_head(lenv* e, lval* a) {
@@ -652,8 +2758,9 @@ lval* builtin_head(lenv* e, lval* a) {
     LASSERT_TYPE("head", a, 0, LVAL_QEXPR);
     LASSERT_NOT_EMPTY("head", a, 0);
 
-    lval* v = lval_take(a, 0);
-    while (v->count > 1) { lval_del(lval_pop(v, 1)); }
+    /* Share the first element rather than trimming the whole list */
+    lval* v = lval_add(lval_qexpr(), lval_ref(a->cell[0]->cell[0]));
+    lval_del(a);
     return v;
 }
 
@@ -663,7 +2770,7 @@ lval* builtin_tail(lenv* e, lval* a) {
     LASSERT_TYPE("tail", a, 0, LVAL_QEXPR);
     LASSERT_NOT_EMPTY("tail", a, 0);
 
-    lval* v = lval_take(a, 0);
+    lval* v = lval_own(lval_take(a, 0));
     lval_del(lval_pop(v, 0));
     return v;
 }
@@ -679,7 +2786,7 @@ lval* builtin_eval(lenv* e, lval* a) {
     LASSERT_NUM("eval", a, 1);
     LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
 
-    lval* x = lval_take(a, 0);
+    lval* x = lval_own(lval_take(a, 0));
     x->type = LVAL_SEXPR;
     return lval_eval(e, x);
 }
@@ -690,7 +2797,7 @@ lval* builtin_join(lenv* e, lval* a) {
         LASSERT_TYPE("join", a, i, LVAL_QEXPR);
     }
 
-    lval* x = lval_pop(a, 0);
+    lval* x = lval_own(lval_pop(a, 0));
 
     while (a->count) {
         x = lval_join(x, lval_pop(a, 0));
@@ -702,12 +2809,12 @@ lval* builtin_join(lenv* e, lval* a) {
 
 /* Join two lvals together */
 lval* lval_join(lval* x, lval* y) {
-    /* For each cell in `y` add it to `x` */
-    while (y->count) {
-        x = lval_add(x, lval_pop(y, 0));
+    /* For each cell in `y` add a shared reference to `x` */
+    for (int i = 0; i < y->count; i++) {
+        x = lval_add(x, lval_ref(y->cell[i]));
     }
 
-    /* Delete the empty `y` and return `x` */
+    /* Release `y` and return `x` */
     lval_del(y);
     return x;
 }
@@ -718,12 +2825,12 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
     
     lval* syms = a->cell[0];
     for (int i = 0; i < syms->count; i++) {
-      LASSERT(a, (syms->cell[i]->type == LVAL_SYM),
+      LASSERT(a, (syms->cell[i]->type == LVAL_SYM), LERR_TYPE,
         "Function '%s' cannot define non-symbol. Got %s, Expected %s.",
         func, ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
     }
     
-    LASSERT(a, (syms->count == a->count-1),
+    LASSERT(a, (syms->count == a->count-1), LERR_ARGS,
       "Function '%s' passed too many arguments for symbols. Got %i, Expected %i.",
       func, syms->count, a->count-1);
       
@@ -750,53 +2857,104 @@ lval* builtin_lambda(lenv* e, lval* a) {
     
     /* Check first Q-Expression contains only Symbols */
     for (int i = 0; i < a->cell[0]->count; i++) {
-      LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
+      LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM), LERR_TYPE,
         "Cannot define non-symbol. Got %s, Expected %s.",
         ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
     }
     
-    /* Pop first two arguments and pass them to lval_lambda */
+    /* Pop first two arguments and pass them to lval_lambda_new */
     lval* formals = lval_pop(a, 0);
     lval* body = lval_pop(a, 0);
     lval_del(a);
-    
-    return lval_lambda(formals, body);
+    return lval_lambda_new(formals, body);
+}
+
+/* Create a lambda from checked formals and body, consuming them */
+lval* lval_lambda_new(lval* formals, lval* body) {
+    /* Address references to the formals by frame and slot */
+    lval_resolve(body, &formals, 1);
+    lval* f = lval_lambda(formals, body);
+
+#if LVM_ENABLE
+    /* Compile the body for the VM */
+    f->code = lval_compile(body);
+    if (lvm_dump) {
+        lval_println(f);
+        lvm_print(f->code);
+    }
+#endif
+    return f;
+}
+
+/* Annotate symbols in `v` that refer to one of the enclosing lambdas'
+*  formals with the depth of that lambda's frame and the binding's slot
+*  in it. `scopes` holds the formals lists, innermost last */
+void lval_resolve(lval* v, lval** scopes, int n) {
+    switch (v->type) {
+      case LVAL_SYM:
+        for (int d = 0; d < n; d++) {
+            lval* formals = scopes[n-1-d];
+            int slot = 0;
+            for (int i = 0; i < formals->count; i++) {
+                if (formals->cell[i]->sym == lsym_amp) { continue; }
+                if (formals->cell[i]->sym == v->sym) {
+                    v->depth = d;
+                    v->slot = slot;
+                    return;
+                }
+                slot++;
+            }
+        }
+      break;
+      case LVAL_SEXPR:
+      case LVAL_QEXPR:
+        /* A nested lambda's body is one frame deeper */
+        if (v->count == 3 && v->cell[0]->type == LVAL_SYM && v->cell[0]->sym == lsym_lambda
+            && v->cell[1]->type == LVAL_QEXPR && v->cell[2]->type == LVAL_QEXPR
+            && n < LVAL_RESOLVE_DEPTH) {
+            lval* inner[LVAL_RESOLVE_DEPTH];
+            memcpy(inner, scopes, sizeof(lval*) * n);
+            inner[n] = v->cell[1];
+            lval_resolve(v->cell[2], inner, n + 1);
+            return;
+        }
+        for (int i = 0; i < v->count; i++) { lval_resolve(v->cell[i], scopes, n); }
+      break;
+    }
 }
 
 /* Builtin function for ordering */
-lval* builtin_ord(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-    LASSERT_TYPE(op, a, 0, LVAL_NUM);
-    LASSERT_TYPE(op, a, 1, LVAL_NUM);
-
-    int r;
-    if (strcmp(op, ">")  == 0) { r = (a->cell[0]->num >  a ->cell[1]->num); }
-    if (strcmp(op, "<")  == 0) { r = (a->cell[0]->num <  a ->cell[1]->num); }
-    if (strcmp(op, ">=") == 0) { r = (a->cell[0]->num >= a ->cell[1]->num); }
-    if (strcmp(op, "<=") == 0) { r = (a->cell[0]->num <= a ->cell[1]->num); }
+lval* builtin_ord(lenv* e, lval* a, int op) {
+    LASSERT_NUM(lnum_names[op], a, 2);
+    LASSERT_TYPE(lnum_names[op], a, 0, LVAL_NUM);
+    LASSERT_TYPE(lnum_names[op], a, 1, LVAL_NUM);
+
+    lval* x = lnum_apply(op, a->cell[0]->num, a->cell[1]->num);
     lval_del(a);
-    return lval_num(r);
+    return x;
 }
 
 /* Builtin functions for comparisons */
-lval* builtin_gt(lenv* e, lval* a) { return builtin_ord(e, a, ">"); }
-lval* builtin_lt(lenv* e, lval* a) { return builtin_ord(e, a, "<"); }
-lval* builtin_ge(lenv* e, lval* a) { return builtin_ord(e, a, ">="); }
-lval* builtin_le(lenv* e, lval* a) { return builtin_ord(e, a, "<="); }
+lval* builtin_gt(lenv* e, lval* a) { return builtin_ord(e, a, LNUM_GT); }
+lval* builtin_lt(lenv* e, lval* a) { return builtin_ord(e, a, LNUM_LT); }
+lval* builtin_ge(lenv* e, lval* a) { return builtin_ord(e, a, LNUM_GE); }
+lval* builtin_le(lenv* e, lval* a) { return builtin_ord(e, a, LNUM_LE); }
 
 /* Builtin function for equality comparing */
-lval* builtin_cmp(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-    int r;
-    if (strcmp(op, "==") == 0) { r =  lval_eq(a->cell[0], a->cell[1]); }
-    if (strcmp(op, "!=") == 0) { r = !lval_eq(a->cell[0], a->cell[1]); }
+lval* builtin_cmp(lenv* e, lval* a, int op) {
+    LASSERT_NUM(lnum_names[op], a, 2);
+
+    /* Numbers compare directly, anything else structurally */
+    lval* x = a->cell[0]->type == LVAL_NUM && a->cell[1]->type == LVAL_NUM
+      ? lnum_apply(op, a->cell[0]->num, a->cell[1]->num)
+      : lval_num(lval_eq(a->cell[0], a->cell[1]) == (op == LNUM_EQ));
     lval_del(a);
-    return lval_num(r);
+    return x;
 }
 
 /* Builtin functions for equality testing */
-lval* builtin_eq(lenv* e, lval* a) { return builtin_cmp(e, a, "=="); }
-lval* builtin_ne(lenv* e, lval* a) { return builtin_cmp(e, a, "!="); }
+lval* builtin_eq(lenv* e, lval* a) { return builtin_cmp(e, a, LNUM_EQ); }
+lval* builtin_ne(lenv* e, lval* a) { return builtin_cmp(e, a, LNUM_NE); }
 
 /* Builtin function for if statements */
 lval* builtin_if(lenv* e, lval* a) {
@@ -805,18 +2963,12 @@ lval* builtin_if(lenv* e, lval* a) {
     LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
     LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
 
-    /* Mark both expressions as evaluable */
-    lval* x;
-    a->cell[1]->type = LVAL_SEXPR;
-    a->cell[2]->type = LVAL_SEXPR;
+    /* Take the chosen branch, copying it only if shared */
+    lval* x = lval_own(lval_pop(a, a->cell[0]->num ? 1 : 2));
 
-    if (a->cell[0]->num) {
-        /* If condition is true, eval first expr */
-        x = lval_eval(e, lval_pop(a, 1));
-    } else {
-        /* Otherwise, eval second expr */
-        x = lval_eval(e, lval_pop(a, 2));
-    }
+    /* Mark the expression as evaluable and evaluate it */
+    x->type = LVAL_SEXPR;
+    x = lval_eval(e, x);
 
     /* Delete arglist and return */
     lval_del(a);
@@ -828,13 +2980,16 @@ lval* builtin_load(lenv* e, lval* a) {
     LASSERT_NUM("load", a, 1);
     LASSERT_TYPE("load", a, 0, LVAL_STR);
 
-    /* Parse File given by string name */
-    mpc_result_t r;
-    if (mpc_parse_contents(a->cell[0]->str, Lispy, &r)) {
-
-    /* Read contents */
-    lval* expr = lval_read(r.output);
-    mpc_ast_delete(r.output);
+    /* Read File given by string name */
+    lval* expr = lval_read_file(a->cell[0]->str);
+    if (expr->type == LVAL_ERR) {
+        /* Create new error message using the reader's */
+        lval* err = lval_err(LERR_LOAD, "Could not load Library %s", lval_err_msg(expr));
+        lval_err_msg(err);
+        lval_del(expr);
+        lval_del(a);
+        return err;
+    }
 
     /* Evaluate each Expression */
     while (expr->count) {
@@ -850,20 +3005,6 @@ lval* builtin_load(lenv* e, lval* a) {
 
     /* Return empty list */
     return lval_sexpr();
-
-    } else {
-        /* Get Parse Error as String */
-        char* err_msg = mpc_err_string(r.error);
-        mpc_err_delete(r.error);
-
-        /* Create new error message using it */
-        lval* err = lval_err("Could not load Library %s", err_msg);
-        free(err_msg);
-        lval_del(a);
-
-        /* Cleanup and return error */
-        return err;
-    }
 }
 
 /* Builtin function to print strings */
@@ -885,15 +3026,119 @@ lval* builtin_error(lenv* e, lval* a) {
     LASSERT_NUM("error", a, 1);
     LASSERT_TYPE("error", a, 0, LVAL_STR);
 
-    /* Construct error */
-    lval* err = lval_err(a->cell[0]->str);
+    /* Construct error, rendered now as the string goes with the args */
+    lval* err = lval_err(LERR_USER, "%s", a->cell[0]->str);
+    lval_err_msg(err);
 
     /* Delete args and return */
     lval_del(a);
     return err;
 }
 
+/* Builtin function to test for errors, called as (error-code {expr}).
+*  Gives the code of the error `expr` evaluates to, or 0 if none */
+lval* builtin_error_code(lenv* e, lval* a) {
+    LASSERT_NUM("error-code", a, 1);
+    LASSERT_TYPE("error-code", a, 0, LVAL_QEXPR);
+
+    lval* x = builtin_eval(e, a);
+    int code = x->type == LVAL_ERR ? x->ecode : LERR_NONE;
+    lval_del(x);
+    return lval_num(code);
+}
+
+/* Builtin function to memoise a function, called as (memo f) or as
+*  (memo f n) to keep at most n results */
+lval* builtin_memo(lenv* e, lval* a) {
+    LASSERT(a, a->count == 1 || a->count == 2, LERR_ARGS,
+        "Function 'memo' passed incorrect number of arguments. Got %i, Expected 1 or 2.",
+        a->count);
+    LASSERT_TYPE("memo", a, 0, LVAL_FUN);
+
+    int max = LMEMO_MAX;
+    if (a->count == 2) {
+        LASSERT_TYPE("memo", a, 1, LVAL_NUM);
+        LASSERT(a, a->cell[1]->num > 0 && a->cell[1]->num <= 1 << 24, LERR_ARGS,
+            "Function 'memo' passed a size out of range: %li.", a->cell[1]->num);
+        max = a->cell[1]->num;
+    }
+    return lval_memo(lval_take(a, 0), max);
+}
+
+/* Builtin function to report a memoised function's cache as
+*  {hits misses evictions entries}, called as (memo-stats f) */
+lval* builtin_memo_stats(lenv* e, lval* a) {
+    LASSERT_NUM("memo-stats", a, 1);
+    LASSERT_TYPE("memo-stats", a, 0, LVAL_FUN);
+    LASSERT(a, LFUN_MEMO(a->cell[0]), LERR_TYPE,
+        "Function 'memo-stats' passed a function that isn't memoised.");
+
+    lmemo* m = a->cell[0]->args->memo;
+    lval* x = lval_qexpr();
+    x = lval_add(x, lval_num(m->hits));
+    x = lval_add(x, lval_num(m->misses));
+    x = lval_add(x, lval_num(m->evictions));
+    x = lval_add(x, lval_num(m->count));
+    lval_del(a);
+    return x;
+}
+
+/* Builtin function to run the garbage collector, called as (gc {}) */
+lval* builtin_gc(lenv* e, lval* a) {
+    LASSERT_NUM("gc", a, 1);
+    LASSERT_TYPE("gc", a, 0, LVAL_QEXPR);
+    lval_del(a);
+
+    /* Values on the evaluator stack are still live, so stay conservative */
+    return lval_num(lgc_collect(0));
+}
+
+/* Builtin function to report heap usage as {values environments bytes},
+*  called as (heap {}) */
+lval* builtin_heap(lenv* e, lval* a) {
+    LASSERT_NUM("heap", a, 1);
+    LASSERT_TYPE("heap", a, 0, LVAL_QEXPR);
+    lval_del(a);
+
+    /* Measure before building the result so it isn't counted */
+    long vals = lgc_nvals;
+    long envs = lgc_nenvs;
+    long bytes = lslab_envs.live * lslab_envs.size + lslab_frames.live * lslab_frames.size;
+    for (int i = 0; i < LGC_SLABS; i++) { bytes += lgc_slabs[i]->live * lgc_slabs[i]->size; }
+
+    lval* x = lval_qexpr();
+    x = lval_add(x, lval_num(vals));
+    x = lval_add(x, lval_num(envs));
+    x = lval_add(x, lval_num(bytes));
+    return x;
+}
+
+/* Builtin function to report allocator counters as
+*  {value-hits value-misses env-hits env-misses}, called as (slab {}) */
+lval* builtin_slab(lenv* e, lval* a) {
+    LASSERT_NUM("slab", a, 1);
+    LASSERT_TYPE("slab", a, 0, LVAL_QEXPR);
+    lval_del(a);
+
+    /* Snapshot the counters so building the result doesn't skew them */
+    long vhits = 0, vmisses = 0;
+    for (int i = 0; i < LGC_SLABS; i++) {
+        vhits += lgc_slabs[i]->hits;
+        vmisses += lgc_slabs[i]->misses;
+    }
+    long ehits = lslab_envs.hits + lslab_frames.hits;
+    long emisses = lslab_envs.misses + lslab_frames.misses;
+
+    lval* x = lval_qexpr();
+    x = lval_add(x, lval_num(vhits));
+    x = lval_add(x, lval_num(vmisses));
+    x = lval_add(x, lval_num(ehits));
+    x = lval_add(x, lval_num(emisses));
+    return x;
+}
+
 int main(int argc, char** argv) {
+#if LREAD_MPC
 	/* Create parsers */
 	Number  = mpc_new("number");
     Symbol  = mpc_new("symbol");
@@ -918,20 +3163,33 @@ int main(int argc, char** argv) {
         lispy   : /^/ <expr>* /$/ ;                  \
       ",
       Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+    lrule_init();
+#endif
 
 
 	/* Print Version and Exit Information */
 	puts("Lispy Version 0.0.3.0.0");
 	puts("Press Ctrl+c to Exit\n");
 
-    /* Create a new environment */
+    /* Create the shared numbers and a new environment */
+    lfix_init();
+    lsym_amp = lsym_intern("&");
+    lsym_lambda = lsym_intern("\\");
+    lsym_if = lsym_intern("if");
     lenv* e = lenv_new();
+    lgc_set_root(e);
     lenv_add_builtins(e);
 
     /* Supplied with list of files */
     if (argc >= 2) {
         /* Loop other each filename */
         for (int i = 1; i < argc; i++) {
+            /* Flag to show the code lambdas compile to */
+            if (strcmp(argv[i], "--dump-code") == 0) {
+                lvm_dump = 1;
+                continue;
+            }
+
             /* Create an arglist with a single arg being the filename */
             lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
 
@@ -941,6 +3199,9 @@ int main(int argc, char** argv) {
             /* If there's an error, print it */
             if (x->type == LVAL_ERR) { lval_println(x); }
             lval_del(x);
+
+            /* Only the environment is live between files */
+            lgc_maybe_collect();
         }
     }
     while (1) {
@@ -950,28 +3211,25 @@ int main(int argc, char** argv) {
         /* Add input to history */
         add_history(input);
         
-        /* Attempt to parse input */
-        mpc_result_t r;
-        if (mpc_parse("<stdin>", input, Lispy, &r)) {
-            /* Print AST on success */
-            lval* x = lval_eval(e, lval_read(r.output));
-            lval_println(x);
-            lval_del(x);
-            mpc_ast_delete(r.output);
-        } else {
-            /* Otherwise, print the error */
-            mpc_err_print(r.error);
-            mpc_err_delete(r.error);
-        }
+        /* Attempt to read input, printing the result or syntax error */
+        lval* x = lval_read_src("<stdin>", input);
+        if (x->type != LVAL_ERR) { x = lval_eval(e, x); }
+        lval_println(x);
+        lval_del(x);
 
         /* Free retrived input */
         free(input);
+
+        /* Only the environment is live between lines */
+        lgc_maybe_collect();
     }
 
     lenv_del(e);
 
+#if LREAD_MPC
 	/* Undefine and delete parsers */
 	mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+#endif
 
 	return 0;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef _LISPY_H
 #define _LISPY_H
 
+#include <stddef.h>
 #include "lib/mpc.h"
 
 /* Compile these functions if we're on Windows */
@@ -35,28 +36,109 @@ void add_history(char* unused) {}
 /***************************
 * Macros, Enums, and Structs
 ***************************/
-#define LASSERT(args, cond, fmt, ...) \
-	if (!(cond)) { lval* err = lval_err(fmt, ##__VA_ARGS__); lval_del(args); return err; }
+#define LASSERT(args, cond, code, fmt, ...) \
+	if (!(cond)) { lval* err = lval_err(code, fmt, ##__VA_ARGS__); lval_del(args); return err; }
 
 #define LASSERT_TYPE(func, args, index, expect) \
-	LASSERT(args, args->cell[index]->type == expect, \
+	LASSERT(args, args->cell[index]->type == expect, LERR_TYPE, \
 		"Function '%s' passed incorrect type for argument %i. Got %s, expected %s.", \
 		func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
 
 #define LASSERT_NUM(func, args, num) \
-  LASSERT(args, args->count == num, \
+  LASSERT(args, args->count == num, LERR_ARGS, \
     "Function '%s' passed incorrect number of arguments. Got %i, Expected %i.", \
     func, args->count, num)
 
 #define LASSERT_NOT_EMPTY(func, args, index) \
-  LASSERT(args, args->cell[index]->count != 0, \
+  LASSERT(args, args->cell[index]->count != 0, LERR_EMPTY, \
     "Function '%s' passed {} for argument %i.", func, index);
 
+/* Fewest live lvals before the heap is worth collecting */
+#ifndef LGC_MIN_HEAP
+#define LGC_MIN_HEAP 65536
+#endif
+
+/* Set to 0 to allocate lval and lenv nodes with plain malloc */
+#ifndef LSLAB_ENABLE
+#define LSLAB_ENABLE 1
+#endif
+
+/* Nodes carved from each slab */
+#ifndef LSLAB_NODES
+#define LSLAB_NODES 1024
+#endif
+
+/* Bindings an lenv can hold before it is hash indexed */
+#ifndef LENV_HASH_MIN
+#define LENV_HASH_MIN 16
+#endif
+
+/* Deepest nesting of lambdas the resolver addresses */
+#define LVAL_RESOLVE_DEPTH 8
+
+/* Bindings an activation frame stores inline before allocating arrays */
+#ifndef LENV_INLINE
+#define LENV_INLINE 4
+#endif
+
+/* Range of numbers preallocated once and shared rather than allocated */
+#ifndef LFIX_MIN
+#define LFIX_MIN -128
+#endif
+#ifndef LFIX_MAX
+#define LFIX_MAX 1023
+#endif
+
+/* Set to 0 to run every lambda body on the tree evaluator */
+#ifndef LVM_ENABLE
+#define LVM_ENABLE 1
+#endif
+
+/* Dispatch VM instructions with computed gotos where supported */
+#ifndef LVM_COMPUTED_GOTO
+#ifdef __GNUC__
+#define LVM_COMPUTED_GOTO 1
+#else
+#define LVM_COMPUTED_GOTO 0
+#endif
+#endif
+
+/* Compile hot numeric lambdas to x86-64 machine code */
+#ifndef LJIT_ENABLE
+#if defined(__x86_64__) && defined(__linux__) && LVM_ENABLE
+#define LJIT_ENABLE 1
+#else
+#define LJIT_ENABLE 0
+#endif
+#endif
+
+/* Calls to a lambda before it is considered for the JIT */
+#ifndef LJIT_THRESHOLD
+#define LJIT_THRESHOLD 100
+#endif
+
+/* Set to 1 to read source through the mpc grammar instead of the reader */
+#ifndef LREAD_MPC
+#define LREAD_MPC 0
+#endif
+
+/* Results a memoised function keeps, unless given when it is made */
+#ifndef LMEMO_MAX
+#define LMEMO_MAX 4096
+#endif
+
+/* Elements an S/Q-expression stores inline before needing a buffer */
+#ifndef LVAL_INLINE
+#define LVAL_INLINE 4
+#endif
+
 /* Forward declarations for the compiler */
 struct lval;
 struct lenv;
+struct lcells;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lcells lcells;
 
 mpc_parser_t* Number;
 mpc_parser_t* Symbol;
@@ -67,49 +149,285 @@ mpc_parser_t* Qexpr;
 mpc_parser_t* Expr;
 mpc_parser_t* Lispy;
 
+/* Rules of the grammar that lval_read tells apart. lrule_init maps
+*  the id mpca_lang gives each parser onto these */
+enum { LRULE_NONE, LRULE_NUMBER, LRULE_SYMBOL, LRULE_STRING, LRULE_COMMENT,
+       LRULE_SEXPR, LRULE_QEXPR, LRULE_EXPR, LRULE_LISPY, LRULE_COUNT };
+
+/* Bound on the parser ids lrule_init can map */
+#define LRULE_IDS 64
+
 /* lval possible types */
-enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN };
+enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN, LVAL_CODE, LVAL_MEMO, LVAL_FREE };
+
+/* Error codes, as given by `error-code`. Keep stdlib.lspy in step */
+enum { LERR_NONE, LERR_USER, LERR_UNBOUND, LERR_TYPE, LERR_ARGS, LERR_EMPTY,
+       LERR_DIV_ZERO, LERR_NOT_FUN, LERR_FORMAT, LERR_NUMBER, LERR_LOAD };
+
+/* Most arguments an error message is formatted with */
+#define LERR_ARGS_MAX 4
+
+/* Raw argument of an error message, for a %s or a %i */
+typedef union {
+	long i;
+	char* s;
+} lerr_arg;
+
+/* VM opcodes */
+enum { LOP_CONST, LOP_LOAD, LOP_CALL, LOP_IF, LOP_JUMP, LOP_TAIL, LOP_FOLD };
+
+/* Operators of the numeric builtins */
+enum { LNUM_ADD, LNUM_SUB, LNUM_MUL, LNUM_DIV, LNUM_GT, LNUM_LT, LNUM_GE, LNUM_LE, LNUM_EQ, LNUM_NE };
+
+/* VM instruction. `v` is a constant or symbol, `a` and `b` a count or
+*  jump targets. Loads cache the global binding found in `cache`, valid
+*  while the global epoch is still `epoch`. Folds keep the form and the
+*  builtins the constant depends on in `cache` instead */
+typedef struct {
+	int op;
+	int a;
+	int b;
+	lval* v;
+	lval* cache;
+	unsigned long epoch;
+} lins;
 
 /* Builtin function type */
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
+/* Global a JIT compiled lambda relies on being bound to `builtin`, or
+*  to the lambda itself if that is NULL */
+typedef struct {
+	char* sym;
+	lbuiltin builtin;
+} ljit_dep;
+
+/* Native code for a lambda, called with its arguments as an array and
+*  setting the status to nonzero if it had to give up */
+typedef struct {
+	void* mem;
+	size_t size;
+	long (*entry)(long*, int*);
+	int nargs;
+	unsigned long epoch;
+	int ndeps;
+	ljit_dep* deps;
+} ljit;
+
+/* Cached result of a memoised function. Entries are chained by index
+*  into hash buckets, and into a list from most to least recently used */
+typedef struct {
+	unsigned long hash;
+	lval* key;
+	lval* val;
+	int chain;
+	int prev;
+	int next;
+} lmemo_entry;
+
+/* Cache of a memoised function, holding up to `max` results */
+typedef struct {
+	lmemo_entry* entries;
+	int count;
+	int size;
+	int max;
+	int* buckets;
+	int nbuckets;
+	int first;
+	int last;
+	long hits;
+	long misses;
+	long evictions;
+} lmemo;
+
 /* Lisp Value struct */
 struct lval {
     int type;
 
-    /* Basic */
-    long num;
-    char* err;
-    char* sym;
-    char* str;
-
-    /* Function */
-    lbuiltin builtin;
-    lenv* env;
-    lval* formals;
-    lval* body;
-
-    /* Expression */
-    int count;
-    lval** cell;
+    /* Number of owners sharing this value */
+    int refs;
+
+    /* Garbage collector bookkeeping. The collector finds every lval by
+    *  walking the slabs, so nodes need no links of their own */
+    int gc_refs;
+    int mark;
+
+    /* Payload, only the member for `type` is valid */
+    union {
+        /* Basic */
+        long num;
+        char* str;
+
+        /* Error, rendered from `fmt` and its arguments only once the
+        *  message is needed. The message then replaces the format */
+        struct {
+            int ecode;
+            int rendered;
+            union {
+                char* fmt;
+                char* err;
+            };
+            lerr_arg eargs[LERR_ARGS_MAX];
+        };
+
+        /* Symbol, with the frame depth and slot it resolves to if known,
+        *  and the slot of its last global binding */
+        struct {
+            char* sym;
+            int depth;
+            int slot;
+            int gslot;
+        };
+
+        /* Function, with its body compiled to `code` when possible. A
+        *  partial application holds the arguments given so far in `args`
+        *  for its `base` lambda. A memoised function keeps its cache in
+        *  `args` instead. Arguments are bound in a fresh frame for each
+        *  call, so lambdas need no environment of their own */
+        struct {
+            lbuiltin builtin;
+            lval* formals;
+            lval* body;
+            lval* code;
+            lval* base;
+            lval* args;
+        };
+
+        /* Compiled code, internal to functions. `consts` keeps alive
+        *  every lval the instructions point to. `calls` counts calls
+        *  towards the JIT, or is -1 if the code is unsuitable */
+        struct {
+            lins* ins;
+            int ins_count;
+            int stack;
+            lval* consts;
+            ljit* jit;
+            int calls;
+        };
+
+        /* Memo cache, internal to memoised functions */
+        lmemo* memo;
+
+        /* Expression, a view of `count` elements from `cell`. These live
+        *  inline after the node while few enough, and in the buffer
+        *  `cells` after */
+        struct {
+            int count;
+            lval** cell;
+            lcells* cells;
+        };
+    };
 };
 
+/* Bytes allocated for a number, which needs no more of the node */
+#define LVAL_NUM_SIZE (offsetof(lval, num) + sizeof(long))
+
+/* Inline elements of an S/Q-expression, which is allocated with room
+*  for LVAL_INLINE of them after the node */
+#define LVAL_INL(v) ((lval**)((v) + 1))
+
+/* Element buffer shared by S/Q-expressions. Holds a reference to each
+*  of items[lo..used), with room for `size`. Lists view a window of it
+*  ending at or before used */
+struct lcells {
+	int refs;
+	int mark;
+	int lo;
+	int used;
+	int size;
+	lval* items[];
+};
+
+/* Interned symbol name, tracking how many non-global lenvs bind it */
+typedef struct {
+	int locals;
+	char name[];
+} lsym;
+
+/* Get the lsym holding an interned name */
+#define LSYM(s) ((lsym*)((s) - offsetof(lsym, name)))
+
+/* Check whether a function value is memoised */
+#define LFUN_MEMO(f) (!(f)->builtin && (f)->base && (f)->args->type == LVAL_MEMO)
+
+/* Header of a slab, chaining it to the slab carved before it. With
+*  slabs disabled each node gets its own, chained both ways */
+typedef struct lslab_hdr {
+	struct lslab_hdr* prev;
+	struct lslab_hdr* next;
+} lslab_hdr;
+
+/* Size class of fixed-size nodes, with a free list of released nodes
+*  and a partially used slab of fresh ones. Every slab is chained from
+*  `slabs` so that the nodes can be walked */
+typedef struct {
+	size_t size;
+	void* free;
+	lslab_hdr* slabs;
+	char* next;
+	char* end;
+	long hits;
+	long misses;
+	long live;
+} lslab;
+
+/* Position of a walk over the nodes of a size class */
+typedef struct {
+	lslab_hdr* h;
+	char* p;
+	char* end;
+} lslab_cursor;
+
 /* Lisp Environment struct */
 struct lenv {
 	lenv* par;
 	int count;
+	int size;
 	char** syms;
 	lval** vals;
+
+	/* Hash index into syms/vals, only built for large lenvs */
+	int* index;
+	int index_size;
+
+	/* Set for activation frames, which are allocated with room for
+	*  their first LENV_INLINE bindings after the lenv. syms/vals use
+	*  those slots until they are full */
+	int frame;
 };
 
+/* Inline binding slots of an activation frame */
+#define LENV_ISYMS(e) ((char**)((e) + 1))
+#define LENV_IVALS(e) ((lval**)(LENV_ISYMS(e) + LENV_INLINE))
+
+/* Bytes allocated for an activation frame */
+#define LENV_FRAME_SIZE (sizeof(lenv) + (sizeof(char*) + sizeof(lval*)) * LENV_INLINE)
+
 /**********************
 * Function declarations
 **********************/
 
 char* ltype_name(int);
 
+void* lslab_alloc(lslab*);
+void  lslab_free(lslab*, void*);
+void  lslab_walk(lslab*, lslab_cursor*);
+void* lslab_step(lslab*, lslab_cursor*);
+
+lval* lval_alloc(int);
+void  lval_free(lval*);
+lenv* lenv_alloc(int);
+void  lenv_free(lenv*);
+
+void  lgc_set_root(lenv*);
+long  lgc_collect(int);
+void  lgc_maybe_collect(void);
+
+void  lfix_init(void);
 lval* lval_num(long);
-lval* lval_err(char*, ...);
+lval* lval_err(int, char*, ...);
+char* lval_err_msg(lval*);
+char* lsym_intern(char*);
 lval* lval_sym(char*);
 lval* lval_sexpr(void);
 lval* lval_qepxr(void);
@@ -118,15 +436,24 @@ lval* lval_str(char*);
 
 lenv* lenv_new(void);
 void  lenv_del(lenv*);
-lenv* lenv_copy(lenv*);
+lenv* lenv_frame(void);
+void  lenv_index(lenv*);
+int   lenv_find(lenv*, char*);
+void  lenv_unbind(lenv*);
 
+lval* lval_ref(lval*);
 void  lval_del(lval*);
+lval* lval_own(lval*);
+lcells* lcells_new(int);
+void  lcells_del(lcells*);
+void  lval_cells_own(lval*, int);
 lval* lval_add(lval*, lval*);
 lval* lval_copy(lval*);
 
 lval* lenv_get(lenv*, lval*);
 void  lenv_def(lenv*, lval*, lval*);
 void  lenv_put(lenv*, lval*, lval*);
+void  lenv_set(lenv*, char*, lval*);
 void  lenv_add_builtin(lenv*, char*, lbuiltin);
 void  lenv_add_builtins(lenv*);
 
@@ -135,18 +462,38 @@ void lval_print_str(lval*);
 void lval_print(lval*);
 void lval_println(lval*);
 
+void  lrule_init(void);
 lval* lval_read_num(mpc_ast_t*);
 lval* lval_read_str(mpc_ast_t*);
 lval* lval_read(mpc_ast_t*);
+lval* lval_read_src(char*, char*);
+lval* lval_read_file(char*);
 
 lval* lval_pop(lval*, int);
 lval* lval_take(lval*, int);
 lval* lval_eval(lenv*, lval*);
 lval* lval_eval_sexpr(lenv*, lval*);
+lval* lval_eval_tail(lenv*, lval*, lval**, lval**);
 lval* lval_call(lenv*, lval*, lval*);
+int   lval_partial(lval*, int);
+lenv* lval_bind(lenv*, lval*, lval*, lval**);
 int   lval_eq(lval*, lval*);
+unsigned long lval_hash(lval*);
+
+lval* lval_memo(lval*, int);
+lval* lmemo_call(lenv*, lval*, lval*);
+
+lval* lval_compile(lval*);
+lval* lvm_apply(lenv*, lval**, int, lval**, lval**);
+lval* lvm_run(lenv*, lval*, lval**, lval**);
+void  lvm_print(lval*);
 
-lval* builtin_op(lenv*, lval*, char*);
+ljit* ljit_compile(lval*);
+void  ljit_free(ljit*);
+
+lval* lnum_apply(int, long, long);
+int   lnum_opcode(lbuiltin);
+lval* builtin_op(lenv*, lval*, int);
 lval* builtin_add(lenv*, lval*);
 lval* builtin_sub(lenv*, lval*);
 lval* builtin_mul(lenv*, lval*);
@@ -162,14 +509,16 @@ lval* builtin_var(lenv*, lval*, char*);
 lval* builtin_def(lenv*, lval*);
 lval* builtin_put(lenv*, lval*);
 lval* builtin_lambda(lenv*, lval*);
+lval* lval_lambda_new(lval*, lval*);
+void  lval_resolve(lval*, lval**, int);
 
-lval* builtin_ord(lenv*, lval*, char*);
+lval* builtin_ord(lenv*, lval*, int);
 lval* builtin_gt(lenv*, lval*);
 lval* builtin_lt(lenv*, lval*);
 lval* builtin_ge(lenv*, lval*);
 lval* builtin_le(lenv*, lval*);
 
-lval* builtin_cmp(lenv*, lval*, char*);
+lval* builtin_cmp(lenv*, lval*, int);
 lval* builtin_eq(lenv*, lval*);
 lval* builtin_ne(lenv*, lval*);
 lval* builtin_if(lenv*, lval*);
@@ -177,5 +526,13 @@ lval* builtin_if(lenv*, lval*);
 lval* builtin_load(lenv*, lval*);
 lval* builtin_print(lenv*, lval*);
 lval* builtin_error(lenv*, lval*);
+lval* builtin_error_code(lenv*, lval*);
+
+lval* builtin_memo(lenv*, lval*);
+lval* builtin_memo_stats(lenv*, lval*);
+
+lval* builtin_gc(lenv*, lval*);
+lval* builtin_heap(lenv*, lval*);
+lval* builtin_slab(lenv*, lval*);
 
 #endif
\ No newline at end of file
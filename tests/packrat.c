@@ -0,0 +1,66 @@
+/* Packrat parsing. Build and run from the repository root with
+*    gcc -std=c99 -Ilib -o packrat tests/packrat.c lib/mpc.c -lm && ./packrat
+*  Each input is parsed with and without MPC_LANG_PACKRAT and the error
+*  text must match. Exits non-zero on any mismatch */
+
+#include "mpc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Alternatives share a prefix, so rules are parsed again at the same
+*  place and replayed from the cache, and optional parts leave errors */
+static const char* grammar =
+    " expr   : <term> '+' <expr> | <term> '-' <expr> | <term> ;   "
+    " term   : <factor> '*' <term> | <factor> ;                   "
+    " factor : /[0-9]+/ 'x'? | '(' <expr> ')' | <word>* 'y' ;     "
+    " word   : \"w\" ;                                            "
+    " line   : /^/ <expr> /$/ ;                                   ";
+
+static const char* inputs[] = {
+    "1+", "(1+2", "1*(2-)", "12x3", "(1+2)*(3", "1+2-", "ww1", ")",
+    "((1)+(2*(3+", "1x*2x-", "(((1)))*(((2", "1+2*3", "",
+};
+
+/* Parse `src` in one mode, returning the error text or "ok" */
+static char* parse(const char* src, int flags) {
+    mpc_parser_t* Expr   = mpc_new("expr");
+    mpc_parser_t* Term   = mpc_new("term");
+    mpc_parser_t* Factor = mpc_new("factor");
+    mpc_parser_t* Word   = mpc_new("word");
+    mpc_parser_t* Line   = mpc_new("line");
+    mpca_lang(flags, grammar, Expr, Term, Factor, Word, Line);
+
+    mpc_result_t r;
+    char* msg;
+    if (mpc_parse("<test>", src, Line, &r)) {
+        mpc_ast_delete(r.output);
+        msg = malloc(3);
+        strcpy(msg, "ok");
+    } else {
+        msg = mpc_err_string(r.error);
+        mpc_err_delete(r.error);
+    }
+
+    mpc_cleanup(5, Expr, Term, Factor, Word, Line);
+    return msg;
+}
+
+int main(void) {
+    int fails = 0;
+    int n = sizeof(inputs) / sizeof(inputs[0]);
+
+    for (int i = 0; i < n; i++) {
+        char* plain = parse(inputs[i], MPC_LANG_DEFAULT);
+        char* packrat = parse(inputs[i], MPC_LANG_PACKRAT);
+        if (strcmp(plain, packrat) != 0) {
+            printf("FAIL \"%s\"\n  plain:   %s  packrat: %s", inputs[i], plain, packrat);
+            fails++;
+        }
+        free(plain);
+        free(packrat);
+    }
+
+    printf("%i of %i inputs give the same result with packrat parsing\n", n - fails, n);
+    return fails != 0;
+}